@@ -10,7 +10,7 @@
 #ifndef _ATMEGA644CONSTANTS_H
 #define _ATMEGA644CONSTANTS_H
 
-#include <avr/io.h>
+#include "os_hal.h"
 
 
 //----------------------------------------------------------------------------
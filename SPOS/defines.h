@@ -34,6 +34,30 @@
 //! The current id of the exercise (this must be changed every two weeks).
 #define VERSUCH 4
 
+/*!
+ *  Build the simulator benchmark image instead of the test tasks
+ *  (set to 1 by `make bench`, see os_bench.h).
+ */
+#ifndef SPOS_BENCH
+#define SPOS_BENCH 0
+#endif
+
+/*!
+ *  Per-process CPU accounting and scheduler run time histogram (see
+ *  os_stats.h), costs about 140 bytes of globals.
+ */
+#ifndef OS_CPU_STATS
+#define OS_CPU_STATS 1
+#endif
+
+/*!
+ *  Allocation counters per heap and process (see os_memory_stats.h), costs
+ *  about 150 bytes of globals.
+ */
+#ifndef OS_MEM_STATS
+#define OS_MEM_STATS 1
+#endif
+
 //----------------------------------------------------------------------------
 // System constants
 //----------------------------------------------------------------------------
@@ -61,12 +85,104 @@
 //! Number to specify an invalid process
 #define INVALID_PROCESS             255
 
+//! Compare value of Timer 2 for one time slice (61 * 1024 cycles, about 3.1 ms)
+#define SCHEDULER_PERIOD            60
+
+//! Compare value of Timer 2 while only idle is runnable (256 * 1024 cycles, about 13.1 ms)
+#define SCHEDULER_IDLE_PERIOD       255
+
+/*!
+ *  Tickless idle: idle puts the MCU to sleep instead of printing dots, and
+ *  the scheduler stretches the time slice to SCHEDULER_IDLE_PERIOD while no
+ *  other process is runnable.
+ */
+#ifndef OS_TICKLESS_IDLE
+#define OS_TICKLESS_IDLE            1
+#endif
+
 //----------------------------------------------------------------------------
 // Heap constants
 //----------------------------------------------------------------------------
 
+/*!
+ *  Write-back cache of the external SRAM driver (see os_mem_drivers.c):
+ *  EXT_CACHE_LINES direct-mapped lines of EXT_CACHE_LINE_SIZE bytes each,
+ *  both powers of two, at most 8 lines.
+ */
+#ifndef OS_EXT_CACHE
+#define OS_EXT_CACHE				1
+#endif
+#define EXT_CACHE_LINES				4
+#define EXT_CACHE_LINE_SIZE			16
+
+/*!
+ *  SPI transfers of at least this many bytes park a waiting process (see
+ *  os_spi.c), shorter ones are polled. Two process switches take about as
+ *  long as shifting out this many bytes.
+ */
+#ifndef OS_SPI_BLOCK_MIN
+#define OS_SPI_BLOCK_MIN			64
+#endif
+
 //! An offset to not overwrite global variables
-#define HEAPOFFSET					300
+#define HEAPOFFSET					(524 + (OS_INT_HEAP_FREE_RUNS + OS_EXT_HEAP_FREE_RUNS) * 4 + OS_CPU_STATS * 140 + OS_MEM_STATS * 150 + (OS_MEM_HANDLES ? OS_MEM_HANDLES * 9 + 14 : 0) \
+									+ OS_EXT_CACHE * (EXT_CACHE_LINES * (EXT_CACHE_LINE_SIZE + 2) + 1) \
+									+ SPOS_BENCH * 64)
+
+/*!
+ *  Number of free runs the index of the internal and the external heap holds
+ *  before falling back to map scans (at most 255, 4 bytes of internal SRAM
+ *  each). The external heap is large enough to be split into many runs.
+ */
+#ifndef OS_INT_HEAP_FREE_RUNS
+#define OS_INT_HEAP_FREE_RUNS		16
+#endif
+#ifndef OS_EXT_HEAP_FREE_RUNS
+#define OS_EXT_HEAP_FREE_RUNS		64
+#endif
+#if OS_INT_HEAP_FREE_RUNS > 255 || OS_EXT_HEAP_FREE_RUNS > 255
+#error "The free run index holds at most 255 runs"
+#endif
+
+/*!
+ *  Lazy zeroing of the use area: Erasing a heap in the task manager only
+ *  clears its map, and os_malloc and os_realloc clear the bytes they hand out
+ *  instead. This makes the erase take a third of the time.
+ */
+#ifndef OS_MEM_LAZY_ZERO
+#define OS_MEM_LAZY_ZERO			0
+#endif
+
+/*!
+ *  Bytes per map nibble (the allocation unit) of the internal and the external
+ *  heap as a power of two, from 0 (1 byte) to 4 (16 bytes). Allocations are
+ *  rounded up to whole units. Larger units shrink the map from a third of the
+ *  heap to 1 / (1 + 2 * unit) of it, and the map scans shrink with it.
+ */
+#ifndef OS_INT_HEAP_BLOCK_SHIFT
+#define OS_INT_HEAP_BLOCK_SHIFT		0
+#endif
+#ifndef OS_EXT_HEAP_BLOCK_SHIFT
+#define OS_EXT_HEAP_BLOCK_SHIFT		0
+#endif
+#if OS_INT_HEAP_BLOCK_SHIFT > 4 || OS_EXT_HEAP_BLOCK_SHIFT > 4
+#error "A map nibble covers at most 16 bytes"
+#endif
+
+//! Number of chunks (of all processes) every heap keeps track of for the garbage collection before falling back to map scans
+#define OS_MEM_OWNED_CHUNKS			32
+
+/*!
+ *  Number of movable chunks (see os_memory_handles.h) per heap, 0 leaves out
+ *  the handles and the compaction in idle time.
+ */
+#ifndef OS_MEM_HANDLES
+#define OS_MEM_HANDLES				8
+#endif
+
+//! Number of block orders of the buddy strategy, the largest buddy chunk spans 2^15 blocks
+#define OS_MEM_BUDDY_ORDERS			16
+
 //----------------------------------------------------------------------------
 // Stack constants
 //----------------------------------------------------------------------------
@@ -92,5 +208,28 @@
 //! The bottom of the memory chunk with number PID.
 #define PROCESS_STACK_BOTTOM(PID)   (BOTTOM_OF_PROCS_STACK - ((PID) * STACK_SIZE_PROC))
 
+//! Stack integrity checks done by the scheduler (see OS_STACK_CHECK)
+#define OS_STACK_CHECK_OFF          0
+#define OS_STACK_CHECK_CANARY       1
+#define OS_STACK_CHECK_CHECKSUM     2
+
+/*!
+ *  How the scheduler checks the stacks of the processes it switches between:
+ *   - OS_STACK_CHECK_OFF: not at all
+ *   - OS_STACK_CHECK_CANARY: guard bytes at the far (lowest) end of every
+ *     process stack, which catch a stack running into its neighbour
+ *   - OS_STACK_CHECK_CHECKSUM: checksum over the bottom of the stack, which
+ *     catches foreign writes to the saved context
+ */
+#ifndef OS_STACK_CHECK
+#define OS_STACK_CHECK              OS_STACK_CHECK_CANARY
+#endif
+
+//! Number of guard bytes at the end of every process stack
+#define STACK_CANARY_SIZE           2
+
+//! Value of the guard bytes
+#define STACK_CANARY_VALUE          0xA5
+
 
 #endif
@@ -0,0 +1,574 @@
+/*! \file
+ *
+ * Benchmark harness and the benchmark program that replaces the test tasks in
+ * simulator builds (`make bench`). Every result is one line
+ *
+ *     BENCH <op> <heap> <variant> <min> <avg> <max>
+ *
+ * with cycle counts per call. Measurements run inside a critical section, so a
+ * scheduler interrupt never lands in the middle of an operation. The cost of
+ * reading the counter itself is subtracted.
+ * Note that simavr has no model of the external 23LC SRAM attached, so reads
+ * on the external heap always return 0 and its map always looks empty. The
+ * external heap is therefore only measured with BENCH_EXTERNAL_HEAP set (on
+ * hardware), otherwise it is reported as
+ *
+ *     BENCH skip <heap>
+ *
+ * After the single calls, a stress run lets BENCH_STRESS_WORKERS processes
+ * allocate concurrently with every heap, strategy and size profile. While they
+ * run, the fragmentation is sampled every BENCH_STRESS_SAMPLE_MS as
+ *
+ *     BENCH frag <heap> <strategy> <profile> <ms> <ops> <free> <largest> <runs> <ext%>
+ *
+ * and every run ends with
+ *
+ *     BENCH stress <heap> <strategy> <profile> <ms> <ops> <failed> <ops/s>
+ *
+ * where ops counts os_malloc, os_realloc and os_free calls of all workers and
+ * failed the ones that returned 0.
+ */
+
+#include "os_bench.h"
+
+#if SPOS_BENCH
+
+#include "os_core.h"
+#include "os_memory.h"
+#include "os_memory_stats.h"
+#include "os_scheduler.h"
+#include "util.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+
+//! Baud rate register value for 115200 baud at 20 MHz with double speed
+#define BENCH_UBRR 21
+
+//! How many times every operation is measured
+#define BENCH_ROUNDS 8
+
+//! Size of the chunks allocated by the benchmark (in bytes)
+#define BENCH_CHUNK_SIZE 16
+
+//! Gaps in the busy loop larger than this (in cycles) are taken as preemption
+#define BENCH_SWITCH_THRESHOLD 400
+
+//! Number of processes allocating concurrently in a stress run
+#ifndef BENCH_STRESS_WORKERS
+#define BENCH_STRESS_WORKERS 3
+#endif
+
+//! Operations every worker does per stress run
+#ifndef BENCH_STRESS_OPS
+#define BENCH_STRESS_OPS 200
+#endif
+
+//! Interval of the fragmentation samples during a stress run (in ms)
+#ifndef BENCH_STRESS_SAMPLE_MS
+#define BENCH_STRESS_SAMPLE_MS 50
+#endif
+
+//! Most chunks a worker holds at the same time
+#define BENCH_STRESS_SLOTS 8
+
+//! Whether the external heap is measured, which needs the 23LC SRAM to be there
+#ifndef BENCH_EXTERNAL_HEAP
+#define BENCH_EXTERNAL_HEAP 0
+#endif
+
+//! Upper 16 bits of the cycle counter
+static volatile uint16_t os_bench_overflows;
+
+//! Cycles needed to read the counter twice, subtracted from every measurement
+static Cycles os_bench_overhead;
+
+/*!
+ *  Extends Timer 1 to a 32 bit cycle counter.
+ */
+ISR(TIMER1_OVF_vect) {
+	os_bench_overflows++;
+}
+
+/*!
+ *  Starts Timer 1 without prescaler and USART0 as result output.
+ */
+void os_bench_init(void) {
+	TCCR1A = 0;
+	TCCR1B = (1 << CS10);
+	sbi(TIMSK1, TOIE1);
+
+	UBRR0 = BENCH_UBRR;
+	UCSR0A = (1 << U2X0);
+	UCSR0B = (1 << TXEN0);
+	UCSR0C = (1 << UCSZ01) | (1 << UCSZ00);
+
+	Cycles start = os_bench_cycles();
+	os_bench_overhead = os_bench_cycles() - start;
+}
+
+/*!
+ *  Reads the cycle counter. A pending overflow that was not yet handled by
+ *  the ISR (because interrupts are off) is accounted for, the same way as
+ *  os_systemTime_augment does it for Timer 0.
+ *
+ *  \return The number of cycles since os_bench_init (modulo 2^32).
+ */
+Cycles os_bench_cycles(void) {
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t ticks = TCNT1;
+	uint16_t overflows = os_bench_overflows;
+	if ((TIFR1 & (1 << TOV1)) && ticks < 0x8000) {
+		overflows++;
+	}
+	SREG = sreg;
+	return ((Cycles)overflows << 16) | ticks;
+}
+
+//! Resets a measurement series
+void os_bench_clear(BenchStat *stat) {
+	stat->min = 0xFFFFFFFF;
+	stat->max = 0;
+	stat->sum = 0;
+	stat->count = 0;
+}
+
+//! Adds a measurement to a series
+void os_bench_record(BenchStat *stat, Cycles cycles) {
+	cycles = (cycles > os_bench_overhead) ? (cycles - os_bench_overhead) : 0;
+	if (cycles < stat->min) {
+		stat->min = cycles;
+	}
+	if (cycles > stat->max) {
+		stat->max = cycles;
+	}
+	stat->sum += cycles;
+	stat->count++;
+}
+
+//! Writes a single character to USART0
+static void os_bench_writeChar(char c) {
+	while (!(UCSR0A & (1 << UDRE0)));
+	UDR0 = c;
+}
+
+//! Writes a string from program memory to the result output
+void os_bench_writeProgString(char const *str) {
+	char c;
+	while ((c = (char)pgm_read_byte(str++))) {
+		os_bench_writeChar(c);
+	}
+}
+
+//! Writes a string to the result output
+void os_bench_writeString(char const *str) {
+	while (*str) {
+		os_bench_writeChar(*str++);
+	}
+}
+
+//! Writes an unsigned decimal number to the result output
+void os_bench_writeDec(uint32_t number) {
+	char digits[10];
+	uint8_t count = 0;
+	do {
+		digits[count++] = '0' + (number % 10);
+		number /= 10;
+	} while (number);
+	while (count) {
+		os_bench_writeChar(digits[--count]);
+	}
+}
+
+/*!
+ *  Writes one result line.
+ *
+ *  \param opPStr Name of the measured operation (program memory).
+ *  \param heap Name of the heap used or NULL.
+ *  \param variantPStr Name of the variant (e.g. the allocation strategy) or NULL.
+ *  \param stat The measurement series.
+ */
+void os_bench_report(char const *opPStr, char const *heap, char const *variantPStr, BenchStat const *stat) {
+	os_bench_writeProgString(PSTR("BENCH "));
+	os_bench_writeProgString(opPStr);
+	os_bench_writeChar(' ');
+	if (heap) {
+		os_bench_writeString(heap);
+	} else {
+		os_bench_writeChar('-');
+	}
+	os_bench_writeChar(' ');
+	if (variantPStr) {
+		os_bench_writeProgString(variantPStr);
+	} else {
+		os_bench_writeChar('-');
+	}
+	os_bench_writeChar(' ');
+	if (stat->count) {
+		os_bench_writeDec(stat->min);
+		os_bench_writeChar(' ');
+		os_bench_writeDec(stat->sum / stat->count);
+		os_bench_writeChar(' ');
+		os_bench_writeDec(stat->max);
+	} else {
+		os_bench_writeProgString(PSTR("- - -"));
+	}
+	os_bench_writeChar('\n');
+}
+
+/*!
+ *  Waits for the output to be sent and puts the MCU to sleep with interrupts
+ *  disabled, which makes simavr terminate.
+ */
+void os_bench_exit(void) {
+	os_bench_writeProgString(PSTR("BENCH done\n"));
+	while (!(UCSR0A & (1 << UDRE0)));
+	cli();
+	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+	sleep_enable();
+	sleep_cpu();
+	HALT;
+}
+
+//----------------------------------------------------------------------------
+// Benchmark program
+//----------------------------------------------------------------------------
+
+/*!
+ *  Measures a single statement in a critical section.
+ */
+#define BENCH_MEASURE(STAT, STATEMENT) \
+	do { \
+		os_enterCriticalSection(); \
+		Cycles start__ = os_bench_cycles(); \
+		STATEMENT; \
+		os_bench_record(&(STAT), os_bench_cycles() - start__); \
+		os_leaveCriticalSection(); \
+	} while (0)
+
+//! Names of the allocation strategies as printed in the results
+static char PROGMEM const benchStrategyNames[][6] = {
+	"first",
+	"next",
+	"best",
+	"worst",
+	"buddy"
+};
+
+//! Program that is started and killed by the benchmark
+static void benchDummy(void) {
+	HALT;
+}
+
+/*!
+ *  Measures os_malloc, os_realloc and os_free with every allocation strategy
+ *  on the given heap.
+ */
+static void benchHeap(Heap *heap) {
+	MemAddr chunks[BENCH_ROUNDS];
+	BenchStat stat;
+	AllocStrategy const original = os_getAllocationStrategy(heap);
+
+	for (uint8_t strategy = 0; strategy < sizeof(benchStrategyNames) / sizeof(*benchStrategyNames); strategy++) {
+		char const *strategyName = benchStrategyNames[strategy];
+		os_setAllocationStrategy(heap, (AllocStrategy)strategy);
+
+		os_bench_clear(&stat);
+		for (uint8_t i = 0; i < BENCH_ROUNDS; i++) {
+			BENCH_MEASURE(stat, chunks[i] = os_malloc(heap, BENCH_CHUNK_SIZE));
+		}
+		os_bench_report(PSTR("os_malloc"), heap->name, strategyName, &stat);
+
+		os_bench_clear(&stat);
+		for (uint8_t i = 0; i < BENCH_ROUNDS; i++) {
+			BENCH_MEASURE(stat, chunks[i] = os_realloc(heap, chunks[i], 2 * BENCH_CHUNK_SIZE));
+		}
+		os_bench_report(PSTR("os_realloc"), heap->name, strategyName, &stat);
+
+		os_bench_clear(&stat);
+		for (uint8_t i = 0; i < BENCH_ROUNDS; i++) {
+			BENCH_MEASURE(stat, os_free(heap, chunks[i]));
+		}
+		os_bench_report(PSTR("os_free"), heap->name, strategyName, &stat);
+	}
+
+	os_setAllocationStrategy(heap, original);
+}
+
+/*!
+ *  Measures os_exec and os_kill of a process that never runs to completion.
+ */
+static void benchProcesses(void) {
+	ProcessID pids[BENCH_ROUNDS];
+	BenchStat execStat;
+	BenchStat killStat;
+
+	os_bench_clear(&execStat);
+	os_bench_clear(&killStat);
+	for (uint8_t i = 0; i < BENCH_ROUNDS; i++) {
+		BENCH_MEASURE(execStat, pids[i] = os_exec(benchDummy, DEFAULT_PRIORITY));
+		BENCH_MEASURE(killStat, os_kill(pids[i]));
+	}
+	os_bench_report(PSTR("os_exec"), NULL, NULL, &execStat);
+	os_bench_report(PSTR("os_kill"), NULL, NULL, &killStat);
+}
+
+/*!
+ *  Measures one pass of TIMER2_COMPA_vect from the point of view of the
+ *  preempted process: It spins on the cycle counter and takes every gap that
+ *  is considerably longer than one loop iteration as a scheduler run. With this
+ *  process being the only one ready, the scheduler always switches back to it.
+ */
+static void benchContextSwitch(void) {
+	BenchStat stat;
+	Cycles loop = 0xFFFFFFFF;
+	Cycles last = os_bench_cycles();
+
+	// Calibrate the cost of one loop iteration
+	for (uint8_t i = 0; i < BENCH_ROUNDS; i++) {
+		Cycles now = os_bench_cycles();
+		if (now - last < loop) {
+			loop = now - last;
+		}
+		last = now;
+	}
+
+	os_bench_clear(&stat);
+	last = os_bench_cycles();
+	while (stat.count < BENCH_ROUNDS) {
+		Cycles now = os_bench_cycles();
+		if (now - last > BENCH_SWITCH_THRESHOLD) {
+			os_bench_record(&stat, now - last - loop);
+		}
+		last = now;
+	}
+	os_bench_report(PSTR("TIMER2_COMPA_vect"), NULL, PSTR("switch"), &stat);
+}
+
+/*!
+ *  Size distribution and lifetime of the chunks of a stress run. Every
+ *  operation of a worker picks one of its first `slots` slots: An empty slot
+ *  is allocated, an occupied one reallocated (reallocPercent) or freed, so a
+ *  chunk lives for about 2 * slots operations of its worker. Sizes are uniform
+ *  in [minSize, maxSize], except for largePercent of the allocations, which
+ *  are uniform in [largeMin, largeMax].
+ */
+typedef struct {
+	char name[8];
+	uint8_t minSize;
+	uint8_t maxSize;
+	uint8_t largeMin;
+	uint8_t largeMax;
+	uint8_t largePercent;
+	uint8_t reallocPercent;
+	uint8_t slots;
+} BenchProfile;
+
+//! Size profiles of the stress runs
+static BenchProfile PROGMEM const benchProfiles[] = {
+	// name       min max  large     %  realloc slots
+	{"small",     4,  16,  0,   0,   0, 10,     8},
+	{"mixed",     1,  64,  0,   0,   0, 25,     4},
+	{"bimodal",   8,  16,  96,  160, 10, 0,     6},
+};
+
+//! Parameters of the current stress run, read by the workers
+static struct {
+	Heap *heap;
+	BenchProfile profile;
+} benchStressRun;
+
+//! Operations done and failed per worker, only written by the worker itself
+static uint16_t benchStressOps[MAX_NUMBER_OF_PROCESSES];
+static uint16_t benchStressFailed[MAX_NUMBER_OF_PROCESSES];
+
+//! 16 bit xorshift, so every worker has a reproducible sequence of its own
+static uint16_t benchRandom(uint16_t *state) {
+	*state ^= *state << 7;
+	*state ^= *state >> 9;
+	*state ^= *state << 8;
+	return *state;
+}
+
+//! Random number in [min, max]
+static uint8_t benchRandomRange(uint16_t *state, uint8_t min, uint8_t max) {
+	return min + benchRandom(state) % (max - min + 1);
+}
+
+//! Random chunk size according to the profile
+static uint8_t benchStressSize(BenchProfile const *profile, uint16_t *state) {
+	if (benchRandom(state) % 100 < profile->largePercent) {
+		return benchRandomRange(state, profile->largeMin, profile->largeMax);
+	}
+	return benchRandomRange(state, profile->minSize, profile->maxSize);
+}
+
+/*!
+ *  Worker of a stress run. It leaves its chunks behind when it terminates,
+ *  so the garbage collection of os_kill is part of the measurement.
+ */
+static void benchStressWorker(void) {
+	ProcessID const pid = os_getCurrentProc();
+	Heap *const heap = benchStressRun.heap;
+	BenchProfile const *const profile = &benchStressRun.profile;
+	MemAddr chunks[BENCH_STRESS_SLOTS] = {0};
+	uint16_t state = 0xACE1 ^ pid;
+
+	for (uint16_t i = 0; i < BENCH_STRESS_OPS; i++) {
+		MemAddr *chunk = &chunks[benchRandom(&state) % profile->slots];
+		bool failed = false;
+
+		if (!*chunk) {
+			*chunk = os_malloc(heap, benchStressSize(profile, &state));
+			failed = !*chunk;
+		} else if (benchRandom(&state) % 100 < profile->reallocPercent) {
+			MemAddr const moved = os_realloc(heap, *chunk, benchStressSize(profile, &state));
+			if (moved) {
+				*chunk = moved;
+			}
+			failed = !moved;
+		} else {
+			os_free(heap, *chunk);
+			*chunk = 0;
+		}
+
+		benchStressOps[pid]++;
+		benchStressFailed[pid] += failed;
+	}
+}
+
+//! Writes "BENCH <op> <heap> <strategy> <profile>" of the current stress run
+static void benchStressPrefix(char const *opPStr, char const *strategyPStr) {
+	os_bench_writeProgString(PSTR("BENCH "));
+	os_bench_writeProgString(opPStr);
+	os_bench_writeChar(' ');
+	os_bench_writeString(benchStressRun.heap->name);
+	os_bench_writeChar(' ');
+	os_bench_writeProgString(strategyPStr);
+	os_bench_writeChar(' ');
+	os_bench_writeString(benchStressRun.profile.name);
+}
+
+//! Writes a number preceded by a space
+static void benchWriteField(uint32_t number) {
+	os_bench_writeChar(' ');
+	os_bench_writeDec(number);
+}
+
+//! Sums up the counters of all workers
+static void benchStressCount(uint32_t *ops, uint32_t *failed) {
+	*ops = 0;
+	*failed = 0;
+	os_enterCriticalSection();
+	for (ProcessID pid = 0; pid < MAX_NUMBER_OF_PROCESSES; pid++) {
+		*ops += benchStressOps[pid];
+		*failed += benchStressFailed[pid];
+	}
+	os_leaveCriticalSection();
+}
+
+/*!
+ *  Runs BENCH_STRESS_WORKERS workers with one strategy and profile on the
+ *  heap and waits for them, sampling the fragmentation in between.
+ */
+static void benchStress(Heap *heap, uint8_t strategy, uint8_t profile) {
+	char const *strategyName = benchStrategyNames[strategy];
+	ProcessID workers[BENCH_STRESS_WORKERS];
+	HeapFragmentation frag;
+	uint32_t ops;
+	uint32_t failed;
+	bool running;
+
+	benchStressRun.heap = heap;
+	memcpy_P(&benchStressRun.profile, &benchProfiles[profile], sizeof(BenchProfile));
+	for (ProcessID pid = 0; pid < MAX_NUMBER_OF_PROCESSES; pid++) {
+		benchStressOps[pid] = 0;
+		benchStressFailed[pid] = 0;
+	}
+	os_setAllocationStrategy(heap, (AllocStrategy)strategy);
+
+	Cycles const start = os_bench_cycles();
+	for (uint8_t i = 0; i < BENCH_STRESS_WORKERS; i++) {
+		workers[i] = os_exec(benchStressWorker, DEFAULT_PRIORITY);
+	}
+
+	do {
+		os_sleep(BENCH_STRESS_SAMPLE_MS);
+
+		running = false;
+		for (uint8_t i = 0; i < BENCH_STRESS_WORKERS; i++) {
+			if (workers[i] != INVALID_PROCESS && os_getProcessSlot(workers[i])->state != OS_PS_UNUSED) {
+				running = true;
+			}
+		}
+
+		Cycles const elapsed = os_bench_cycles() - start;
+		benchStressCount(&ops, &failed);
+		os_memStats_fragmentation(heap, &frag);
+
+		benchStressPrefix(PSTR("frag"), strategyName);
+		benchWriteField(elapsed / (F_CPU / 1000));
+		benchWriteField(ops);
+		benchWriteField(frag.freeBytes);
+		benchWriteField(frag.largestRun);
+		benchWriteField(frag.runs);
+		benchWriteField(os_memStats_externalFragmentation(&frag));
+		os_bench_writeChar('\n');
+	} while (running);
+
+	Cycles const elapsed = os_bench_cycles() - start;
+	benchStressCount(&ops, &failed);
+
+	benchStressPrefix(PSTR("stress"), strategyName);
+	benchWriteField(elapsed / (F_CPU / 1000));
+	benchWriteField(ops);
+	benchWriteField(failed);
+	benchWriteField(elapsed ? (uint32_t)((uint64_t)ops * F_CPU / elapsed) : 0);
+	os_bench_writeChar('\n');
+}
+
+//! Whether the heap has working memory behind it in this build
+static bool benchIsMeasured(Heap const *heap) {
+	return BENCH_EXTERNAL_HEAP || heap != extHeap;
+}
+
+REGISTER_AUTOSTART(benchProgram)
+void benchProgram(void) {
+	os_bench_init();
+	os_bench_writeProgString(PSTR("BENCH op heap variant min avg max\n"));
+
+	benchContextSwitch();
+	benchProcesses();
+	for (uint8_t i = 0; i < os_getHeapListLength(); i++) {
+		Heap *heap = os_lookupHeap(i);
+		if (benchIsMeasured(heap)) {
+			benchHeap(heap);
+		} else {
+			os_bench_writeProgString(PSTR("BENCH skip "));
+			os_bench_writeString(heap->name);
+			os_bench_writeChar('\n');
+		}
+	}
+
+	os_bench_writeProgString(PSTR("BENCH frag heap strategy profile ms ops free largest runs ext%\n"));
+	os_bench_writeProgString(PSTR("BENCH stress heap strategy profile ms ops failed ops/s\n"));
+	for (uint8_t i = 0; i < os_getHeapListLength(); i++) {
+		Heap *heap = os_lookupHeap(i);
+		if (!benchIsMeasured(heap)) {
+			continue;
+		}
+		AllocStrategy const original = os_getAllocationStrategy(heap);
+		for (uint8_t strategy = 0; strategy < sizeof(benchStrategyNames) / sizeof(*benchStrategyNames); strategy++) {
+			for (uint8_t profile = 0; profile < sizeof(benchProfiles) / sizeof(*benchProfiles); profile++) {
+				benchStress(heap, strategy, profile);
+			}
+		}
+		os_setAllocationStrategy(heap, original);
+	}
+
+	os_bench_exit();
+}
+
+#endif
@@ -0,0 +1,56 @@
+/*! \file
+ *  \brief Cycle counting benchmark harness for simulator runs.
+ *
+ *  Timer 1 runs without prescaler and is extended to 32 bits by its overflow
+ *  interrupt, so differences of os_bench_cycles() are CPU cycles. Results are
+ *  written line by line to USART0, which simavr echoes to its stdout.
+ *  Everything in here is only compiled if SPOS_BENCH is set (`make bench`).
+ */
+
+#ifndef _OS_BENCH_H
+#define _OS_BENCH_H
+
+#include "defines.h"
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+//! A number of CPU cycles
+typedef uint32_t Cycles;
+
+//! Minimum, maximum and sum over a series of measurements
+typedef struct {
+	Cycles min;
+	Cycles max;
+	Cycles sum;
+	uint8_t count;
+} BenchStat;
+
+//! Starts the cycle counter and the result output
+void os_bench_init(void);
+
+//! Current value of the cycle counter
+Cycles os_bench_cycles(void);
+
+//! Resets a measurement series
+void os_bench_clear(BenchStat *stat);
+
+//! Adds a measurement to a series
+void os_bench_record(BenchStat *stat, Cycles cycles);
+
+//! Writes one result line "BENCH <op> <heap> <variant> <min> <avg> <max>"
+void os_bench_report(char const *opPStr, char const *heap, char const *variantPStr, BenchStat const *stat);
+
+//! Writes a string from program memory to the result output
+void os_bench_writeProgString(char const *str);
+
+//! Writes a string to the result output
+void os_bench_writeString(char const *str);
+
+//! Writes an unsigned decimal number to the result output
+void os_bench_writeDec(uint32_t number);
+
+//! Flushes the output and stops the simulation
+void os_bench_exit(void);
+
+#endif
@@ -95,7 +95,7 @@ void os_init_timer(void) {
     sbi(TCCR2B, CS21); // Prescaler 1024  1
     sbi(TCCR2B, CS20); // Prescaler 1024  1
     sbi(TIMSK2, OCIE2A); // Enable interrupt
-    OCR2A = 60;
+    OCR2A = SCHEDULER_PERIOD;
 
     // Init timer 0 with prescaler 256
     cbi(TCCR0B, CS00);
@@ -122,7 +122,10 @@ void os_init(void) {
     stderr = lcdout;
 
     lcd_writeProgString(PSTR("Booting SPOS ..."));
+#if !SPOS_BENCH
+    // Nobody is there to confirm an unexpected reset source in the simulator
     os_checkResetSource(OS_ALLOWED_RESET_SOURCES);
+#endif
     delayMs(DEFAULT_OUTPUT_DELAY * 20);
 	
 	// Check if the first address of the heap is not too close to globals
@@ -11,7 +11,7 @@
 #ifndef _OS_CORE_H
 #define _OS_CORE_H
 
-#include <avr/pgmspace.h>
+#include "os_hal.h"
 
 
 //! Allowed reset sources that are not considered erroneous resetting of the MCU
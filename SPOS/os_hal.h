@@ -0,0 +1,43 @@
+/*! \file
+ *  \brief Hardware abstraction for the portable parts of the OS.
+ *
+ *  The allocator (os_memory*.c, os_memheap_drivers.c) and the scheduling
+ *  strategies only reach the hardware through MemDriver callbacks and the
+ *  scheduler interface. Besides that they need program memory strings and
+ *  the SRAM layout, which this header takes from avr-libc on the target.
+ *  With SPOS_HOST set (`make host`) it provides plain C replacements instead,
+ *  so these modules build natively against the drivers in host/.
+ */
+
+#ifndef _OS_HAL_H
+#define _OS_HAL_H
+
+#ifndef SPOS_HOST
+#define SPOS_HOST 0
+#endif
+
+#if SPOS_HOST
+
+#include <stdint.h>
+
+//! Program memory is ordinary memory on the host
+#define PROGMEM
+#define PSTR(str) (str)
+#define pgm_read_byte(addr) (*(uint8_t const *)(addr))
+
+#define _BV(bit) (1 << (bit))
+
+//! SRAM layout of the ATmega644, backed by an array in host/os_hal_host.c
+#define RAMSTART 0x100
+#define RAMEND 0x10FF
+#define E2END 0x7FF
+#define FLASHEND 0xFFFF
+
+#else
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#endif
+
+#endif
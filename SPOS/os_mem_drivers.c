@@ -16,6 +16,29 @@
 #include <avr/interrupt.h>
 #include "os_core.h"
 
+#include <stdbool.h>
+#include <string.h>
+
+//! 23LC1024 instruction: read data starting at the given address
+#define EXT_CMD_READ 0x03
+
+//! 23LC1024 instruction: write data starting at the given address
+#define EXT_CMD_WRITE 0x02
+
+//! 23LC1024 instruction: write the mode register
+#define EXT_CMD_WRMR 0x01
+
+//! 23LC1024 mode register: sequential mode (the address auto-increments across pages)
+#define EXT_MODE_SEQUENTIAL 0x40
+
+#if OS_EXT_CACHE
+#if (EXT_CACHE_LINES & (EXT_CACHE_LINES - 1)) || EXT_CACHE_LINES > 8
+#error EXT_CACHE_LINES must be a power of two up to 8
+#endif
+#if (EXT_CACHE_LINE_SIZE & (EXT_CACHE_LINE_SIZE - 1))
+#error EXT_CACHE_LINE_SIZE must be a power of two
+#endif
+#endif
 
 
 
@@ -28,7 +51,7 @@ void internal_init(void) {}
 	
 // External SRAM
 void external_init(void){
-	os_enterCriticalSection();
+	os_enterCriticalSectionFast();
 	DDRB |= (1 << 4);
 	
 	os_spi_init();
@@ -37,14 +60,127 @@ void external_init(void){
 		os_error("extSRAM as slave!");
 	}
 	
-	PORTB &= ~(1 << 4);
-	os_spi_send(0x01);
-	
-	// Byte mode activation
-	os_spi_send(0x00);
+	// Sequential mode activation, single byte accesses work the same in this mode
+	SpiTransfer transfer = {
+		.header = {EXT_CMD_WRMR, EXT_MODE_SEQUENTIAL},
+		.headerLength = 2,
+		.selectPort = &PORTB,
+		.selectMask = (1 << 4)
+	};
+	os_spi_transfer(&transfer);
 	
-	PORTB |= (1 << 4);
-	os_leaveCriticalSection();
+	os_leaveCriticalSectionFast();
+}
+
+// Prepares a transfer of the command with the 24 bit address and length data bytes, nothing is sent or received yet
+static void external_prepare(SpiTransfer *transfer, uint8_t cmd, MemAddr addr, uint16_t length) {
+	transfer->header[0] = cmd;
+	transfer->header[1] = 0x00;
+	transfer->header[2] = addr >> 8;
+	transfer->header[3] = addr & 0xff;
+	transfer->headerLength = 4;
+	transfer->tx = NULL;
+	transfer->rx = NULL;
+	transfer->length = length;
+	transfer->fill = 0xFF;
+	transfer->selectPort = &PORTB;
+	transfer->selectMask = (1 << 4);
+	transfer->done = NULL;
+}
+
+// Streams a block out of the external SRAM with a single command, bypassing the cache
+static void external_readBurst(MemAddr addr, MemValue *buffer, uint16_t length) {
+	SpiTransfer transfer;
+	external_prepare(&transfer, EXT_CMD_READ, addr, length);
+	transfer.rx = buffer;
+	os_spi_transfer(&transfer);
+}
+
+// Streams a block into the external SRAM with a single command, bypassing the cache
+static void external_writeBurst(MemAddr addr, MemValue const *buffer, uint16_t length) {
+	SpiTransfer transfer;
+	external_prepare(&transfer, EXT_CMD_WRITE, addr, length);
+	transfer.tx = buffer;
+	os_spi_transfer(&transfer);
+}
+
+#if OS_EXT_CACHE
+
+/*
+ * Write-back cache of the external SRAM. Single byte accesses go through
+ * EXT_CACHE_LINES direct-mapped lines, which are filled and written back
+ * with one burst each. Block transfers bypass the cache: lines they overlap
+ * are written back first, and dropped if the block transfer writes.
+ */
+
+// Memory line number + 1 held by each cache line, 0 if the cache line is empty
+static uint16_t external_cacheTag[EXT_CACHE_LINES];
+
+// Contents of the cache lines
+static MemValue external_cacheData[EXT_CACHE_LINES][EXT_CACHE_LINE_SIZE];
+
+// Bit i is set if cache line i was written since it was filled
+static uint8_t external_cacheDirty;
+
+// Writes the cache line back to the external SRAM if it was changed
+static void external_cacheWriteBack(uint8_t slot) {
+	if (external_cacheDirty & (1 << slot)) {
+		external_writeBurst((external_cacheTag[slot] - 1) * EXT_CACHE_LINE_SIZE, external_cacheData[slot], EXT_CACHE_LINE_SIZE);
+		external_cacheDirty &= ~(1 << slot);
+	}
+}
+
+// Returns the cached byte at the address, the line is fetched first on a miss
+static MemValue* external_cacheByte(MemAddr addr) {
+	uint16_t const tag = addr / EXT_CACHE_LINE_SIZE + 1;
+	uint8_t const slot = (tag - 1) % EXT_CACHE_LINES;
+	if (external_cacheTag[slot] != tag) {
+		external_cacheWriteBack(slot);
+		external_readBurst(addr & ~(EXT_CACHE_LINE_SIZE - 1), external_cacheData[slot], EXT_CACHE_LINE_SIZE);
+		external_cacheTag[slot] = tag;
+	}
+	return &external_cacheData[slot][addr % EXT_CACHE_LINE_SIZE];
+}
+
+// Writes back the cache lines overlapping the block and drops them if requested
+static void external_cacheSync(MemAddr addr, uint16_t length, bool drop) {
+	for (uint8_t slot = 0; slot < EXT_CACHE_LINES; slot++) {
+		if (external_cacheTag[slot] == 0) {
+			continue;
+		}
+		uint32_t const lineStart = (uint32_t)(external_cacheTag[slot] - 1) * EXT_CACHE_LINE_SIZE;
+		if (lineStart < (uint32_t)addr + length && addr < lineStart + EXT_CACHE_LINE_SIZE) {
+			external_cacheWriteBack(slot);
+			if (drop) {
+				external_cacheTag[slot] = 0;
+			}
+		}
+	}
+}
+
+#endif
+
+//! Writes all changed cache lines back to the external SRAM
+void external_flush(void) {
+#if OS_EXT_CACHE
+	OS_CRITICAL_SECTION {
+		for (uint8_t slot = 0; slot < EXT_CACHE_LINES; slot++) {
+			external_cacheWriteBack(slot);
+		}
+	}
+#endif
+}
+
+//! Drops all cache lines without writing them back, for when the external SRAM was changed behind the driver
+void external_invalidate(void) {
+#if OS_EXT_CACHE
+	OS_CRITICAL_SECTION {
+		for (uint8_t slot = 0; slot < EXT_CACHE_LINES; slot++) {
+			external_cacheTag[slot] = 0;
+		}
+		external_cacheDirty = 0;
+	}
+#endif
 }
 
 // Reads a value from the internal SRAM
@@ -53,39 +189,104 @@ MemValue internal_read(MemAddr addr) {
 }
 
 MemValue external_read(MemAddr addr) {
-	os_enterCriticalSection();
+	os_enterCriticalSectionFast();
 	
-	PORTB &= ~(1 << 4);
-	os_spi_send(0x03);
-	os_spi_send(0x00);
-	os_spi_send(addr >> 8);
-	os_spi_send(addr & 0xff);
+#if OS_EXT_CACHE
+	uint8_t result = *external_cacheByte(addr);
+#else
+	uint8_t result;
+	external_readBurst(addr, &result, 1);
+#endif
 	
-	uint8_t result = os_spi_receive();
-	PORTB |= (1 << 4);
-	
-	os_leaveCriticalSection();
+	os_leaveCriticalSectionFast();
 
 	return result;
 }
 
+// Reads a block from the internal SRAM
+void internal_readBlock(MemAddr addr, MemValue *buffer, uint16_t length) {
+	memcpy(buffer, (MemValue*)addr, length);
+}
+
+/*
+ * Block transfers are queued inside a critical section, so they keep their
+ * order relative to the cache line transfers, but waited for outside of it:
+ * a process outside of critical sections is parked while the bytes are
+ * shifted and the others keep running.
+ */
+
+// Streams a block out of the external SRAM with a single command
+void external_readBlock(MemAddr addr, MemValue *buffer, uint16_t length) {
+	SpiTransfer transfer;
+	external_prepare(&transfer, EXT_CMD_READ, addr, length);
+	transfer.rx = buffer;
+	
+	os_enterCriticalSectionFast();
+#if OS_EXT_CACHE
+	external_cacheSync(addr, length, false);
+#endif
+	os_spi_submit(&transfer);
+	os_leaveCriticalSectionFast();
+	
+	os_spi_wait(&transfer);
+}
+
 // Returns a value on the given address
 void internal_write(MemAddr addr, MemValue value) {
 	*((MemValue*)addr) = value;
 }
 
 void external_write(MemAddr addr, MemValue value) {
-	os_enterCriticalSection();
-	PORTB &= ~(1 << 4);
+	OS_CRITICAL_SECTION {
+#if OS_EXT_CACHE
+		*external_cacheByte(addr) = value;
+		external_cacheDirty |= 1 << ((addr / EXT_CACHE_LINE_SIZE) % EXT_CACHE_LINES);
+#else
+		external_writeBurst(addr, &value, 1);
+#endif
+	}
+}
+
+// Writes a block to the internal SRAM
+void internal_writeBlock(MemAddr addr, MemValue const *buffer, uint16_t length) {
+	memcpy((MemValue*)addr, buffer, length);
+}
+
+// Streams a block into the external SRAM with a single command
+void external_writeBlock(MemAddr addr, MemValue const *buffer, uint16_t length) {
+	SpiTransfer transfer;
+	external_prepare(&transfer, EXT_CMD_WRITE, addr, length);
+	transfer.tx = buffer;
+	
+	os_enterCriticalSectionFast();
+#if OS_EXT_CACHE
+	external_cacheSync(addr, length, true);
+#endif
+	os_spi_submit(&transfer);
+	os_leaveCriticalSectionFast();
+	
+	os_spi_wait(&transfer);
+}
+
+// Sets a block of the internal SRAM to one value
+void internal_fill(MemAddr addr, MemValue value, uint16_t length) {
+	memset((MemValue*)addr, value, length);
+}
+
+// Sets a block of the external SRAM to one value with a single command
+void external_fill(MemAddr addr, MemValue value, uint16_t length) {
+	SpiTransfer transfer;
+	external_prepare(&transfer, EXT_CMD_WRITE, addr, length);
+	transfer.fill = value;
 	
-	os_spi_send(0x02);
-	os_spi_send(0x00);
-	os_spi_send(addr >> 8);
-	os_spi_send(addr & 0xff);
-	os_spi_send(value);
+	os_enterCriticalSectionFast();
+#if OS_EXT_CACHE
+	external_cacheSync(addr, length, true);
+#endif
+	os_spi_submit(&transfer);
+	os_leaveCriticalSectionFast();
 	
-	PORTB |= (1 << 4);
-	os_leaveCriticalSection();
+	os_spi_wait(&transfer);
 }
 
 
@@ -95,6 +296,9 @@ void initMemoryDriver(void) {
 	intSRAM__.init = &internal_init;
 	intSRAM__.read = &internal_read;
 	intSRAM__.write = &internal_write;
+	intSRAM__.readBlock = &internal_readBlock;
+	intSRAM__.writeBlock = &internal_writeBlock;
+	intSRAM__.fill = &internal_fill;
 	intSRAM__.size = AVR_MEMORY_SRAM; 
 	intSRAM__.firstAddr = AVR_SRAM_START; 
 	
@@ -103,6 +307,9 @@ void initMemoryDriver(void) {
 	extSRAM__.init = &external_init;
 	extSRAM__.read = &external_read;
 	extSRAM__.write = &external_write;
+	extSRAM__.readBlock = &external_readBlock;
+	extSRAM__.writeBlock = &external_writeBlock;
+	extSRAM__.fill = &external_fill;
 	extSRAM__.size = 0xFFFF;
 	extSRAM__.firstAddr = 0;
 }
\ No newline at end of file
@@ -9,9 +9,10 @@
 #ifndef _OS_MEM_DRIVERS_H
 #define _OS_MEM_DRIVERS_H
 
-#include <avr/pgmspace.h>
+#include "os_hal.h"
 #include "defines.h"
 #include <inttypes.h>
+#include <stddef.h>
 
 
 //! A type to represent a memory address
@@ -29,6 +30,15 @@ typedef MemValue MemoryRead(MemAddr addr);
 //! A type for the function that writes a value on the specified memory address
 typedef void MemoryWrite(MemAddr addr, MemValue value);
 
+//! A type for the function that reads length values starting at the specified memory address into buffer
+typedef void MemoryReadBlock(MemAddr addr, MemValue *buffer, uint16_t length);
+
+//! A type for the function that writes length values from buffer starting at the specified memory address
+typedef void MemoryWriteBlock(MemAddr addr, MemValue const *buffer, uint16_t length);
+
+//! A type for the function that sets length values starting at the specified memory address to value
+typedef void MemoryFill(MemAddr addr, MemValue value, uint16_t length);
+
 //! Pointer to the driver instance
 #define intSRAM (&intSRAM__)
 
@@ -38,12 +48,21 @@ typedef void MemoryWrite(MemAddr addr, MemValue value);
 //! Initialize the external memory
 void external_init(void);
 
+//! Writes the changed lines of the external SRAM cache back
+void external_flush(void);
+
+//! Drops the external SRAM cache without writing it back
+void external_invalidate(void);
+
 
 //! A general memory driver
 typedef struct {
 	MemoryDriverInit *init;
 	MemoryRead *read;
 	MemoryWrite *write;
+	MemoryReadBlock *readBlock;
+	MemoryWriteBlock *writeBlock;
+	MemoryFill *fill;
 
 	MemAddr firstAddr; // 0x100
 	size_t size;
@@ -8,6 +8,10 @@
 
 #include "os_memheap_drivers.h"
 #include "os_memory_strategies.h"
+#include "os_memory_index.h"
+#include "os_memory_buddy.h"
+#include "os_memory_handles.h"
+#include "os_memory_owners.h"
 #include "defines.h"
 #include "os_mem_drivers.h"
 
@@ -17,6 +21,10 @@ Heap intHeap__;
 //! External Heap
 Heap extHeap__;
 
+//! Free run indices of the heaps (see os_memory_index.h)
+static FreeRun intFreeRuns[OS_INT_HEAP_FREE_RUNS];
+static FreeRun extFreeRuns[OS_EXT_HEAP_FREE_RUNS];
+
 //! An array to store current heaps
 Heap* heaps[2];
 
@@ -40,19 +48,25 @@ void os_initHeaps() {
 	// The starting address of the heap map is set to the starting address of the internal SRAM plus the offset.
 	intHeap__.firstMapAddr = intSRAM__.firstAddr + HEAPOFFSET;
 
-	// The size of the heap map is set to one-third of the total heap size.
-	intHeap__.sizeMap = (heapSize / 3);
+	// Every map byte holds two nibbles, each of them stands for one block of 2^OS_INT_HEAP_BLOCK_SHIFT bytes.
+	// So one map byte and two blocks of the use area belong together, which gives the size of the heap map.
+	intHeap__.blockShift = OS_INT_HEAP_BLOCK_SHIFT;
+	intHeap__.sizeMap = heapSize / (1 + (2 << OS_INT_HEAP_BLOCK_SHIFT));
 
 	// The starting address for the actual usable heap memory (after the heap map) is set to the starting address of the heap map plus its size.
 	intHeap__.firstUseAddr = intHeap__.firstMapAddr + intHeap__.sizeMap;
 
-	// The size of the usable heap memory is set to be two-thirds of the total heap size.
-	intHeap__.sizeUse = 2 * intHeap__.sizeMap;
+	// The usable heap memory consists of two blocks per map byte.
+	intHeap__.blockCount = 2 * intHeap__.sizeMap;
+	intHeap__.sizeUse = (size_t)intHeap__.blockCount << OS_INT_HEAP_BLOCK_SHIFT;
 
 	// The current allocation strategy for the internal heap is set to first-fit.
 	intHeap__.currAllocStrat = OS_MEM_FIRST;
 	
-	intHeap__.nextFitAddrLast = 0;
+	intHeap__.nextFitBlock = 0;
+	
+	intHeap__.freeRuns = intFreeRuns;
+	intHeap__.freeRunCapacity = OS_INT_HEAP_FREE_RUNS;
 
 	// The name of the heap is set to "internal".
 	intHeap__.name = "internal";
@@ -60,28 +74,37 @@ void os_initHeaps() {
 	//heaps[0]->driver->init();
 
 	// All the nibbles of the heap (managed by the driver) are set to 0x00, marking them as free memory blocks.
-	// This is done by iterating over the size of the heap map and writing 0x00 to each location.
-	for(int i = 0; i < intHeap__.sizeMap; ++i) {
-		intHeap__.driver->write(intHeap__.firstMapAddr + i, 0x00);
-	}
+	// The whole map is cleared with one block fill of the driver.
+	intHeap__.driver->fill(intHeap__.firstMapAddr, 0x00, intHeap__.sizeMap);
+	os_memIndex_reset(intHeap);
+	os_memOwners_reset(intHeap);
+	os_memBuddy_reset(intHeap);
+	os_memHandles_reset(intHeap);
 	
 	
 	//	EXTERNAL HEAP INITIALIZATION-------------------------------------------------------------------------------------------------------------
 
 	extHeap__.driver = extSRAM;
 	extHeap__.firstMapAddr = 0;
-	extHeap__.sizeMap = 0xFFFF / 3;
+	extHeap__.blockShift = OS_EXT_HEAP_BLOCK_SHIFT;
+	extHeap__.sizeMap = 0xFFFF / (1 + (2 << OS_EXT_HEAP_BLOCK_SHIFT));
 	extHeap__.firstUseAddr = extHeap__.firstMapAddr + extHeap__.sizeMap;
-	extHeap__.sizeUse = 2 * extHeap__.sizeMap;
+	extHeap__.blockCount = 2 * extHeap__.sizeMap;
+	extHeap__.sizeUse = (size_t)extHeap__.blockCount << OS_EXT_HEAP_BLOCK_SHIFT;
 	extHeap__.currAllocStrat = OS_MEM_FIRST;
-	extHeap__.nextFitAddrLast = 0;
+	extHeap__.nextFitBlock = 0;
+	extHeap__.freeRuns = extFreeRuns;
+	extHeap__.freeRunCapacity = OS_EXT_HEAP_FREE_RUNS;
 	extHeap__.name = "external";
 
 	heaps[1]->driver->init();
 
-	for(int i = 0; i < extHeap__.sizeMap; i++) {
-		extHeap__.driver->write(extHeap__.firstMapAddr + i, 0x00);
-	}
+	// One sequential write command clears the whole map
+	extHeap__.driver->fill(extHeap__.firstMapAddr, 0x00, extHeap__.sizeMap);
+	os_memIndex_reset(extHeap);
+	os_memOwners_reset(extHeap);
+	os_memBuddy_reset(extHeap);
+	os_memHandles_reset(extHeap);
 }
 
 //! Returns the heap count
@@ -11,6 +11,8 @@
 
 #include "os_mem_drivers.h"
 
+#include <stdbool.h>
+
 typedef uint16_t MemAddr;
 typedef uint8_t MemValue;
 
@@ -19,9 +21,37 @@ typedef enum {
 	OS_MEM_FIRST,
 	OS_MEM_NEXT,
 	OS_MEM_BEST,
-	OS_MEM_WORST
+	OS_MEM_WORST,
+	OS_MEM_BUDDY
 } AllocStrategy;
 
+//! A run of free bytes in the use area, relative to its first address
+typedef struct {
+	uint16_t start;
+	uint16_t length;
+} FreeRun;
+
+//! An entry of the chunk owner table (see os_memory_owners.h)
+typedef struct {
+	uint16_t start;		//!< First block of the chunk
+	uint8_t next;		//!< Next entry of the same process or of the unused ones
+} OwnedChunk;
+
+//! A chunk allocated with os_hmalloc (see os_memory_handles.h)
+typedef struct {
+	MemAddr addr;		//!< First address of the chunk, 0 if the entry is unused
+	uint8_t owner;		//!< ProcessID
+	uint8_t locks;		//!< The chunk is only moved while this is 0
+} HandleEntry;
+
+//! Allocation counters of one process on one heap (see os_memory_stats.h)
+typedef struct {
+	uint16_t allocs;	//!< Calls of os_malloc and os_realloc
+	uint16_t frees;		//!< Calls of os_free that released a chunk
+	uint16_t failures;	//!< Allocations that returned 0
+	uint16_t liveBytes;	//!< Bytes the process currently holds (whole blocks)
+} AllocStats;
+
 //! Heap driver
 typedef struct {
 	// Pointer to the driver associated with the heap
@@ -31,21 +61,71 @@ typedef struct {
 	MemAddr firstMapAddr;
 	size_t sizeMap;
 	
-	// The first use area address and the size of the area
+	// The first use area address and the size of the area (in bytes)
 	MemAddr firstUseAddr;
 	size_t sizeUse;
 	
+	// Every map nibble stands for a block of 2^blockShift bytes, the use area holds blockCount of them
+	uint8_t blockShift;
+	uint16_t blockCount;
+	
 	// Current allocation strategy 
 	AllocStrategy currAllocStrat;
 	
 	// Pointer to the name of the heap
 	const char *name;
 	
-	// For Next Fit strategy
-	MemAddr nextFitAddrLast;
+	// Rover of the Next Fit strategy: the block behind the chunk it allocated last
+	uint16_t nextFitBlock;
+	
+	// Chunks of the processes, released by the garbage collection (see os_memory_owners.h)
+	OwnedChunk ownedChunks[OS_MEM_OWNED_CHUNKS];
+	uint8_t ownedFirst[MAX_NUMBER_OF_PROCESSES];
+	uint8_t ownedUnused;
+	
+	// Bit i is set if process i holds chunks that did not fit into ownedChunks
+	uint8_t ownedOverflow;
+	
+	// Free runs sorted by start (see os_memory_index.h), room for freeRunCapacity of them
+	FreeRun *freeRuns;
+	uint8_t freeRunCapacity;
+	
+	// Number of free runs in the map (may exceed freeRunCapacity, 0 if unknown)
+	uint16_t freeRunCount;
+	
+	// Whether freeRuns holds exactly the free runs of the map
+	bool freeRunsValid;
+	
+	// First free block of every order of the buddy strategy (see os_memory_buddy.h)
+	uint16_t buddyFree[OS_MEM_BUDDY_ORDERS];
+	
+	// Whether the buddy lists match the map, and whether free pieces were left out of them
+	bool buddyValid;
+	bool buddyLost;
+	
+#if OS_MEM_HANDLES
+	// Movable chunks and the progress of the compaction
+	HandleEntry handles[OS_MEM_HANDLES];
+	uint16_t compactCursor;
+	bool compactPending;
+	
+	// The chunk the compaction is moving (handle, 0 if none), its new first block, its size and the bytes moved so far
+	uint8_t compactHandle;
+	uint16_t compactTo;
+	uint16_t compactLength;
+	uint16_t compactCopied;
+#endif
+	
+#if OS_MEM_STATS
+	// Allocation counters of every process slot
+	AllocStats allocStats[MAX_NUMBER_OF_PROCESSES];
+	
+	// Bytes requested by successful allocations
+	uint32_t bytesRequested;
 	
-	uint16_t firstNibble[MAX_NUMBER_OF_PROCESSES];
-	uint16_t lastNibble[MAX_NUMBER_OF_PROCESSES];
+	// Time spent in the allocation strategies (Timer 0 counts)
+	uint32_t strategyTime;
+#endif
 } Heap;
 
 //! Internal Heap 
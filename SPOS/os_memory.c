@@ -10,13 +10,189 @@
 
 #include "os_memory.h"
 #include "os_memory_strategies.h"
+#include "os_memory_index.h"
+#include "os_memory_buddy.h"
+#include "os_memory_handles.h"
+#include "os_memory_owners.h"
+#include "os_memory_stats.h"
 #include "util.h"
 #include "os_core.h"
 
+//! Size of the stack buffer used to copy chunks between two places of a heap
+#define OS_MEM_COPY_BUFFER 32
+
+//! Number of map bytes fetched per driver call by the map scanners
+#define OS_MEM_SCAN_BUFFER 16
+
 // ---------------------------------------------------
 //	Private Functions Declarations
 // ---------------------------------------------------
 void setMapEntry(Heap const *heap, MemAddr addr, MemValue value);
+uint16_t getStartOfBlock(Heap const* heap, uint16_t addr);
+
+//! Copies length bytes within the heap in blocks, like memmove the two ranges may overlap
+static void copyBlock(Heap const *heap, MemAddr dst, MemAddr src, uint16_t length) {
+	MemValue buffer[OS_MEM_COPY_BUFFER];
+	// Copying from the end only matters if dst lies inside the source range
+	bool const backward = (dst > src && dst - src < length);
+	
+	while (length > 0) {
+		uint16_t block = (length < OS_MEM_COPY_BUFFER) ? length : OS_MEM_COPY_BUFFER;
+		length -= block;
+		if (backward) {
+			heap->driver->readBlock(src + length, buffer, block);
+			heap->driver->writeBlock(dst + length, buffer, block);
+		} else {
+			heap->driver->readBlock(src, buffer, block);
+			heap->driver->writeBlock(dst, buffer, block);
+			src += block;
+			dst += block;
+		}
+	}
+}
+
+//! Fetches the map bytes holding the nibbles from nib on (but not behind limit), returns their number
+static uint8_t readMapBytes(Heap const *heap, MemValue *buffer, uint16_t nib, uint16_t limit) {
+	uint16_t const first = nib / 2;
+	uint16_t const bytes = (limit + 1) / 2 - first;
+	uint8_t const count = (bytes < OS_MEM_SCAN_BUFFER) ? bytes : OS_MEM_SCAN_BUFFER;
+	
+	heap->driver->readBlock(heap->firstMapAddr + first, buffer, count);
+	return count;
+}
+
+//! Fetches the map bytes holding the nibbles up to nib (but not before 0), returns the index of the first one
+static uint16_t readMapBytesBackward(Heap const *heap, MemValue *buffer, uint16_t nib, uint8_t *count) {
+	uint16_t const last = nib / 2;
+	*count = (last < OS_MEM_SCAN_BUFFER) ? last + 1 : OS_MEM_SCAN_BUFFER;
+	
+	heap->driver->readBlock(heap->firstMapAddr + last + 1 - *count, buffer, *count);
+	return last + 1 - *count;
+}
+
+/*!
+ *  Finds the first nibble in [nib, limit) that differs from value.
+ *  Whole map bytes are compared at once, and pairs of bytes (four nibbles)
+ *  are skipped if both equal the value repeated in both nibbles.
+ *
+ *  \param value 0x0 to skip free nibbles or 0xF to skip the rest of a chunk.
+ *  \return The position of that nibble or limit if there is none.
+ */
+uint16_t os_mapSkipEqual(Heap const *heap, uint16_t nib, uint16_t limit, MemValue value) {
+	MemValue buffer[OS_MEM_SCAN_BUFFER];
+	MemValue const pattern = value | (value << 4);
+	
+	while (nib < limit) {
+		uint8_t const count = readMapBytes(heap, buffer, nib, limit);
+		
+		for (uint8_t i = 0; i < count; i++) {
+			MemValue diff = buffer[i] ^ pattern;
+			
+			if (nib % 2) {
+				// Only the low nibble of the first byte is of interest
+				diff &= 0x0F;
+			} else if (i + 1 < count && (diff | (buffer[i + 1] ^ pattern)) == 0) {
+				nib += 4;
+				i++;
+				continue;
+			}
+			if (diff == 0) {
+				nib += 2 - nib % 2;
+				continue;
+			}
+			if (nib % 2 == 0 && (diff & 0xF0) == 0) {
+				nib++;
+			}
+			return (nib < limit) ? nib : limit;
+		}
+	}
+	return limit;
+}
+
+/*!
+ *  Finds the last nibble at or before nib that differs from value, the
+ *  backward counterpart of os_mapSkipEqual.
+ *
+ *  \return The position of that nibble or 0 if there is none.
+ */
+uint16_t os_mapSkipEqualBackward(Heap const *heap, uint16_t nib, MemValue value) {
+	MemValue buffer[OS_MEM_SCAN_BUFFER];
+	MemValue const pattern = value | (value << 4);
+	
+	for (;;) {
+		uint8_t count;
+		uint16_t const first = readMapBytesBackward(heap, buffer, nib, &count);
+		
+		for (uint8_t i = count; i-- > 0;) {
+			MemValue diff = buffer[i] ^ pattern;
+			
+			if (nib % 2 == 0) {
+				// Only the high nibble of the last byte is of interest
+				diff &= 0xF0;
+			} else if (i > 0 && (diff | (buffer[i - 1] ^ pattern)) == 0) {
+				if (nib < 4) {
+					return 0;
+				}
+				nib -= 4;
+				i--;
+				continue;
+			}
+			if (diff == 0) {
+				if (nib < 2) {
+					return 0;
+				}
+				nib -= 1 + nib % 2;
+				continue;
+			}
+			if (nib % 2 && (diff & 0x0F) == 0) {
+				nib--;
+			}
+			return nib;
+		}
+		if (first == 0) {
+			return 0;
+		}
+	}
+}
+
+/*!
+ *  Finds the first free nibble in [nib, limit). Four nibbles are tested at
+ *  once for a zero nibble with the usual (v - 0x1111) & ~v & 0x8888 trick.
+ *
+ *  \return The position of that nibble or limit if there is none.
+ */
+uint16_t os_mapSkipUsed(Heap const *heap, uint16_t nib, uint16_t limit) {
+	MemValue buffer[OS_MEM_SCAN_BUFFER];
+	
+	while (nib < limit) {
+		uint8_t const count = readMapBytes(heap, buffer, nib, limit);
+		
+		for (uint8_t i = 0; i < count; i++) {
+			MemValue used = buffer[i];
+			
+			if (nib % 2) {
+				// The high nibble of the first byte lies before nib
+				used |= 0xF0;
+			} else if (i + 1 < count) {
+				uint16_t const word = ((uint16_t)used << 8) | buffer[i + 1];
+				if ((((word - 0x1111) & ~word) & 0x8888) == 0) {
+					nib += 4;
+					i++;
+					continue;
+				}
+			}
+			if ((used & 0xF0) && (used & 0x0F)) {
+				nib += 2 - nib % 2;
+				continue;
+			}
+			if (nib % 2 == 0 && (used & 0xF0)) {
+				nib++;
+			}
+			return (nib < limit) ? nib : limit;
+		}
+	}
+	return limit;
+}
 
 
 // ---------------------------------------------------
@@ -25,114 +201,111 @@ MemAddr convertToMemAddr(Heap const* heap, uint16_t nibbleaddr){
 	return heap->firstMapAddr + nibbleaddr/2;
 }
 
-//! Allocates memory in the heap
-MemAddr os_malloc(Heap *heap, size_t size) {
-	os_enterCriticalSection();
+//! Sets the map nibble at the given position of the use area
+static void setNibble(Heap const *heap, uint16_t nib, MemValue value) {
+	MemAddr const mapAddr = convertToMemAddr(heap, nib);
+	MemValue fullByte = heap->driver->read(mapAddr);
+	if (nib % 2 == 0) {
+		fullByte = (fullByte & 0x0F) | (value << 4);
+	} else {
+		fullByte = (fullByte & 0xF0) | value;
+	}
+	heap->driver->write(mapAddr, fullByte);
+}
+
+//! Sets the map nibbles in [from, to) to value, all whole map bytes in between with one fill
+static void setNibbleRange(Heap const *heap, uint16_t from, uint16_t to, MemValue value) {
+	if (from < to && from % 2) {
+		setNibble(heap, from++, value);
+	}
+	if (from < to && to % 2) {
+		setNibble(heap, --to, value);
+	}
+	if (from < to) {
+		heap->driver->fill(convertToMemAddr(heap, from), value | (value << 4), (to - from) / 2);
+	}
+}
+
+//! Reports a range of blocks that was freed in the map to the free run index and the buddy lists
+static void releaseBlocks(Heap *heap, uint16_t start, uint16_t length) {
+	os_memIndex_release(heap, start, length);
+	os_memBuddy_release(heap, start, length);
+	os_memHandles_released(heap);
+}
+
+//! Number of blocks a chunk of size bytes takes with the current allocation strategy
+uint16_t os_chunkBlocks(Heap const *heap, size_t size) {
+	if (size > heap->sizeUse) {
+		return UINT16_MAX;
+	}
+	uint16_t const blocks = os_bytesToBlocks(heap, size);
+	if (blocks != 0 && os_getAllocationStrategy(heap) == OS_MEM_BUDDY) {
+		return os_memBuddy_blocks(heap, blocks);
+	}
+	return blocks;
+}
+
+//! Allocates a chunk of the given number of blocks for the current process, must be called in a critical section
+static MemAddr allocChunk(Heap *heap, uint16_t blocks) {
+	// Zero-sized chunks cannot be represented in the map
+	if (blocks == 0 || blocks > heap->blockCount) {
+		return 0;
+	}
+	
 	MemAddr procMemory = 0;
+#if OS_MEM_STATS
+	Time const strategyStart = os_systemTime_ticks();
+#endif
 	
-	// Allocate bytes depending on the current allocation strategy
+	// Allocate blocks depending on the current allocation strategy
 	switch(os_getAllocationStrategy(heap)) {
 		case OS_MEM_FIRST: 
-			procMemory = os_MemAlloc_FirstFit(heap, size); 
+			procMemory = os_MemAlloc_FirstFit(heap, blocks); 
 			break;
 		case OS_MEM_NEXT:
-			procMemory = os_MemAlloc_NextFit(heap, size);
+			procMemory = os_MemAlloc_NextFit(heap, blocks);
 			break;
 		case OS_MEM_BEST: 
-			procMemory = os_MemAlloc_BestFit(heap, size);
+			procMemory = os_MemAlloc_BestFit(heap, blocks);
 			break;
 		case OS_MEM_WORST: 
-			procMemory = os_MemAlloc_WorstFit(heap, size);
+			procMemory = os_MemAlloc_WorstFit(heap, blocks);
+			break;
+		case OS_MEM_BUDDY:
+			procMemory = os_MemAlloc_Buddy(heap, blocks);
 			break;
 	}
-	
-	
-	// If the needed space cam be allocated
-	if (procMemory != 0) {
-		
-		// Check if proMemory is a high or a low nibble
-		int nib = procMemory % 2;
-		size_t index = 1;
-		
-		// Calculate the size of the map address ???
-		MemAddr	mapAddr = heap->firstMapAddr + (procMemory - heap->firstUseAddr)/2;
-		
-		// Get nibble
-		MemValue nibble = os_getMapEntry(heap, mapAddr);
-
-
-		// If it is the high nibble -> set the low nibble to F cuz it's also allocated
-		if (nib == 0 && size > 1) {
-			nibble = (nibble | 0x0F);
-			// Plus one position allocated
-			index+=1;
-		}
-
-		// Get current process ID
-		ProcessID procID = os_getCurrentProc();
-		
-		// Set the nibble value to the PID of the process which got the memory allocated
-		nibble = (nibble&(0x0F<<(nib*4))) | procID<<((1 - nib)*4); // keep read low nibble and replace high nibble if procMemory is even otherwise reverse
-		
-		// Set a new value of the nibble at mapAddr
-		setMapEntry(heap, mapAddr, nibble);
-		
-		// Allocate the $size$ amount of memory
-		for (; index + 2 <= size; index+=2) {
-			nibble = 0xFF;
-			setMapEntry(heap, (mapAddr + (MemAddr)(index + nib)/2), nibble);
-		}
-		
-		// if there is a nibble left, allocate it as well
-			// only happens if we begun in the hight nibble
-		if (index + 1 <= size) {
-			nibble = os_getMapEntry(heap, mapAddr + (MemAddr)(index + 1)/2);
-			nibble |= 0xF0;
-			setMapEntry(heap, (mapAddr + (MemAddr)(index + 1)/2), nibble);
-		}
-	}
+	os_memStats_strategy(heap, strategyStart);
 	
 	/* Check if no address found*/
 	if(procMemory == 0) {
-		os_leaveCriticalSection();
 		return procMemory;
 	}
+	
+	// The first nibble names the owner, the rest of the chunk is marked with 0xF
+	uint16_t const start = os_addrToBlock(heap, procMemory);
+	ProcessID const procID = os_getCurrentProc();
+	setNibble(heap, start, procID);
+	setNibbleRange(heap, start + 1, start + blocks, 0xF);
+	os_memIndex_take(heap, start, blocks);
 
 	/* For efficient Garbage Collection */
-	if(heap == intHeap) {
-		MemAddr	mapAdr = heap->firstMapAddr + (procMemory - heap->firstUseAddr)/2;
-		Process* curProcess = os_getProcessSlot(os_getCurrentProc());
-		// Case: Process first time calling malloc
-		if( curProcess->allocFrameStartInt > curProcess->allocFrameEndInt  ) {
-			curProcess->allocFrameStartInt	= mapAdr;
-			curProcess->allocFrameEndInt	= mapAdr + size/2;
-		}
-		// Case: New start Addr smaller than allocFrameStart
-		else if( mapAdr < curProcess->allocFrameStartInt) {
-			curProcess->allocFrameStartInt = mapAdr;
-		}
-		// Case: New end Addr larger than allocFrameEnd
-		else if( (mapAdr + size/2) > curProcess->allocFrameEndInt) {
-			curProcess->allocFrameEndInt = mapAdr + size/2;
-		}
-		} else if(heap == extHeap) {
-		MemAddr	mapAdr = heap->firstMapAddr + (procMemory - heap->firstUseAddr)/2;
-		Process* curProcess = os_getProcessSlot(os_getCurrentProc());
-		// Case: Process first time calling malloc
-		if( curProcess->allocFrameStartExt > curProcess->allocFrameEndExt  ) {
-			curProcess->allocFrameStartExt	= mapAdr;
-			curProcess->allocFrameEndExt	= mapAdr + size/2;
-		}
-		// Case: New start Addr smaller than allocFrameStart
-		else if( mapAdr < curProcess->allocFrameStartExt) {
-			curProcess->allocFrameStartExt = mapAdr;
-		}
-		// Case: New end Addr larger than allocFrameEnd
-		else if( (mapAdr + size/2) > curProcess->allocFrameEndExt) {
-			curProcess->allocFrameEndExt = mapAdr + size/2;
-		}
-	}	
+	os_memOwners_add(heap, procID, start);
 	
+	return procMemory;
+}
+
+//! Allocates memory in the heap
+MemAddr os_malloc(Heap *heap, size_t size) {
+	os_enterCriticalSection();
+	uint16_t const blocks = os_chunkBlocks(heap, size);
+	MemAddr procMemory = allocChunk(heap, blocks);
+#if OS_MEM_LAZY_ZERO
+	if (procMemory != 0) {
+		heap->driver->fill(procMemory, 0, blocks << heap->blockShift);
+	}
+#endif
+	os_memStats_alloc(heap, os_getCurrentProc(), size, 0, procMemory);
 	os_leaveCriticalSection();
 	
 	return procMemory;
@@ -182,239 +355,46 @@ MemValue os_getMapEntry(Heap const *heap, MemAddr addr) {
 
 //! The first byte of chunk's address getter
 MemAddr os_getFirstByteOfChunk(Heap const *heap, MemAddr addr) {
-	// Are we in the high or low nibble
-	int nib = addr % 2;
-	
-	// get the map address
-	MemAddr	mapAddr = heap->firstMapAddr + (addr - heap->firstUseAddr)/2;
-	
-	// if low nibble
-	if(nib == 1) {
-		if(getLowNibble(heap, mapAddr) == 0) {
-			return addr;
-		}
-		
-	// if high nibble
-	} else {
-		if(getHighNibble(heap, mapAddr) == 0) {
-			return addr;
-		}
+	return os_blockToAddr(heap, getStartOfBlock(heap, os_addrToBlock(heap, addr)));
+}
+
+//! Whether addr is the first address of a chunk of owner
+bool os_isChunkStart(Heap const *heap, MemAddr addr, ProcessID owner) {
+	if (addr < heap->firstUseAddr || addr - heap->firstUseAddr >= heap->sizeUse) {
+		return false;
 	}
-	
-	// if high nibble and the low nibble is free
-	if(nib == 1 && (getLowNibble(heap, mapAddr) != 0x0F)) {
-		return addr;
-	} else if(nib == 1 && (getHighNibble(heap, mapAddr) != 0x0F)) {
-		return (addr-1);
-	} else if(nib == 0 && (getHighNibble(heap, mapAddr) != 0x0F)) {
-		return addr;
+	uint16_t const block = os_addrToBlock(heap, addr);
+	return os_blockToAddr(heap, block) == addr && getNibble(heap, block) == owner;
+}
+
+//! Frees the chunk only if the owner, returns its size in bytes or 0 if nothing was freed
+static uint16_t freeChunk(Heap *heap, MemAddr addr, ProcessID owner) {
+	// Addresses outside of the use area (like 0) belong to no chunk
+	if (addr < heap->firstUseAddr || addr - heap->firstUseAddr >= heap->sizeUse) {
+		return 0;
 	}
 	
-	if(nib == 1) {
-		addr = addr-2;
-		} else {
-		addr = addr-1;
-	}
-	mapAddr = mapAddr-1;
+	// Find the first block of the chunk related to the address
+	uint16_t const start = getStartOfBlock(heap, os_addrToBlock(heap, addr));
 	
-	MemValue cur = 0;
-	for(; mapAddr >= heap->firstMapAddr; mapAddr--) {
-		cur = os_getMapEntry(heap, mapAddr);
-		for(int i = 0; i <= 1; i++) {
-			if((cur&(0x0F << (i*4))) != 0x0F<<(i*4)) {
-				return addr;
-			}
-			addr--;
-		}
+	// If the owner of the chunk does not match the provided owner, exit the function
+	if (getNibble(heap, start) != owner) {
+		return 0;
 	}
-	return 0;
+	
+	uint16_t const end = os_mapSkipEqual(heap, start + 1, heap->blockCount, 0xF);
+	setNibbleRange(heap, start, end, 0);
+	releaseBlocks(heap, start, end - start);
+	os_memOwners_remove(heap, owner, start);
+	
+	return (end - start) << heap->blockShift;
 }
 
 //! Frees the chunk only if the owner
 void os_freeAsOwner(Heap *heap, MemAddr addr, ProcessID owner) {
-	// Find the first byte of the chunk related to the address
-	MemAddr useAddr = os_getFirstByteOfChunk(heap, addr);
-	
-	size_t toFreeProcSize = os_getChunkSize(heap, useAddr);
-	
-	if(useAddr != 0x0) { // If the address is not null
-
-		int	nib = useAddr % 2; // Compute which nibble to work with, based on the address
-		MemAddr	mapAddr	= heap->firstMapAddr + (useAddr - heap->firstUseAddr)/2; // Compute the corresponding map address
-		MemValue nibble = os_getMapEntry(heap, mapAddr); // Get the current value at the map address
-		MemValue newNibbles = 0; // Placeholder for the new value of the nibbles
-		ProcessID heapOwner	= 0; // Placeholder for the owner of the heap block
-		
-		// Shift and mask the nibble to find the owner of the heap block
-		heapOwner = (nibble>>((1-nib)*4)) & 0x0F;
-
-		// If the owner of the heap block does not match the provided owner, exit the function
-		if (heapOwner != owner) {
-			return;
-		}
-
-		// If the address corresponds to the lower nibble
-		if (nib == 1) {
-			// Set the lower nibble to be free
-			nibble &= 0xF0;
-			setMapEntry(heap, mapAddr, nibble);
-			// Move to the next map address
-			mapAddr++;
-			} else {
-			// Set the upper nibble to be free
-			nibble |= 0xF0;
-			setMapEntry(heap, mapAddr, nibble);
-		}
-		
-		// Iterate over the remaining map addresses
-		do  {
-			// Get the current value at the map address
-			nibble = os_getMapEntry(heap, mapAddr);
-			newNibbles = nibble;
-
-			// If the upper nibble is not free and lower nibble is free, then set the upper nibble free as well
-			if ((newNibbles & 0xF0) == 0xF0) {
-				newNibbles &= 0x0F;
-				
-				// If the lower nibble is also free
-				if ((newNibbles & 0x0F) == 0x0F)
-				// Set the lower nibble free as well
-				newNibbles &= 0xF0;
-			}
-
-			// If the nibble value has changed
-			if (newNibbles != nibble) {
-				// Set the map entry to the new nibbles
-				setMapEntry(heap, mapAddr, newNibbles);
-				// If both nibbles are free, move to the next map address
-				if (newNibbles == 0)
-				mapAddr++;
-				else break;
-			}
-			// Continue until the nibble value doesn't change or until the end of the map addresses is reached
-		} while (newNibbles != nibble && mapAddr < heap->firstUseAddr);
-		
-		
-		
-		/* For efficient garbage collection */
-		mapAddr	= heap->firstMapAddr + (useAddr - heap->firstUseAddr)/2;
-		if(heap == intHeap) {
-			Process* curProcess = os_getProcessSlot(owner);
-
-			// Case: Process owns only one Chunk at the moment
-			// if( (curProcess->allocFrameStartInt == mapAddr) && (curProcess->allocFrameEndInt == mapAddr + (toFreeProcSize/2))) {
-			if( (curProcess->allocFrameStartInt == mapAddr) && ((curProcess->allocFrameEndInt == mapAddr + (toFreeProcSize/2)) || (curProcess->allocFrameEndInt == mapAddr + (toFreeProcSize/2) - 1))) {
-				nibble = os_getMapEntry(heap, curProcess->allocFrameEndInt);
-				if (!( (ProcessID)(nibble>>4) == owner || (ProcessID)(nibble&0x0F) == owner)) {
-					curProcess->allocFrameStartInt	= heap->firstMapAddr + heap->sizeMap - 1;
-					curProcess->allocFrameEndInt	= heap->firstMapAddr;
-				}
-			}
-
-			// Case: We free the chunk which is set to allocFrameStart
-			if((curProcess->allocFrameStartInt == mapAddr) && ((ProcessID)getHighNibble(heap, mapAddr) != owner)) {
-				mapAddr += (toFreeProcSize/2);
-				while(mapAddr <= curProcess->allocFrameEndInt) {
-					nibble = os_getMapEntry(heap, mapAddr);
-					if((ProcessID)(nibble>>4) == owner || (ProcessID)(nibble&0x0F) == owner) {
-						curProcess->allocFrameStartInt = mapAddr;
-						break;
-					}
-					mapAddr++;
-				}
-			}
-			// Case: We free the chunk which is set to allocFrameEnd
-			else if(curProcess->allocFrameEndInt == mapAddr + (toFreeProcSize/2)) {
-				MemAddr tmp = 0;
-				while(mapAddr >= curProcess->allocFrameStartInt) {
-					nibble = os_getMapEntry(heap, mapAddr);
-					if((tmp == 0) && (nibble != 0x00)) {
-						tmp = mapAddr;
-					}
-
-					if((ProcessID)(nibble&0x0F) == owner) {
-						switch(tmp) {
-							case 0: curProcess->allocFrameEndInt	= mapAddr; break;
-							default: curProcess->allocFrameEndInt	= tmp; break;
-						}
-						break;
-						} else if(((ProcessID)(nibble&0x0F) != owner) && ((nibble&0x0F) != 0x0F)) {
-						tmp = 0;
-					}
-
-					if((ProcessID)(nibble>>4) == owner) {
-						switch(tmp) {
-							case 0: curProcess->allocFrameEndInt	= mapAddr; break;
-							default: curProcess->allocFrameEndInt	= tmp; break;
-						}
-						break;
-						} else if((nibble>>4) != 0x0F) {
-						tmp = 0;
-					}
-
-					mapAddr--;
-				}
-			}
-
-		}
-		else if (heap == extHeap) {
-			Process* curProcess = os_getProcessSlot(owner);
-
-			// Case: Process owns only one Chunk at the moment
-			//if( (curProcess->allocFrameStartExt == mapAddr) && (curProcess->allocFrameEndExt == mapAddr + (toFreeProcSize/2))) {
-			if( (curProcess->allocFrameStartExt == mapAddr) && ((curProcess->allocFrameEndExt == mapAddr + (toFreeProcSize/2)) || (curProcess->allocFrameEndExt == mapAddr + (toFreeProcSize/2) - 1))) {
-				nibble = os_getMapEntry(heap, curProcess->allocFrameEndExt);
-				if (!( (ProcessID)(nibble>>4) == owner || (ProcessID)(nibble&0x0F) == owner)) {
-					curProcess->allocFrameStartExt	= heap->firstMapAddr + heap->sizeMap - 1;
-					curProcess->allocFrameEndExt	= heap->firstMapAddr;
-				}
-			}
-
-			// Case: We free the chunk which is set to allocFrameStart
-			if(curProcess->allocFrameStartExt == mapAddr && ((ProcessID)getHighNibble(heap, mapAddr) != owner)) {
-				mapAddr += (toFreeProcSize/2);
-				while(mapAddr <= curProcess->allocFrameEndExt) {
-					nibble = os_getMapEntry(heap, mapAddr);
-					if((ProcessID)(nibble>>4) == owner || (ProcessID)(nibble&0x0F) == owner) {
-						curProcess->allocFrameStartExt = mapAddr;
-						break;
-					}
-					mapAddr++;
-				}
-			}
-			// Case: We free the chunk which is set to allocFrameEnd
-			else if(curProcess->allocFrameEndExt == mapAddr + (toFreeProcSize/2)) {
-				MemAddr tmp = 0;
-				while(mapAddr >= curProcess->allocFrameStartExt) {
-					nibble = os_getMapEntry(heap, mapAddr);
-					if((tmp == 0) && (nibble != 0x00)) {
-						tmp = mapAddr;
-					}
-
-					if((ProcessID)(nibble&0x0F) == owner) {
-						switch(tmp) {
-							case 0: curProcess->allocFrameEndExt	= mapAddr; break;
-							default: curProcess->allocFrameEndExt	= tmp; break;
-						}
-						break;
-						} else if(((ProcessID)(nibble&0x0F) != owner) && ((nibble&0x0F) != 0x0F)) {
-						tmp = 0;
-					}
-
-					if((ProcessID)(nibble>>4) == owner) {
-						switch(tmp) {
-							case 0: curProcess->allocFrameEndExt	= mapAddr; break;
-							default: curProcess->allocFrameEndExt	= tmp; break;
-						}
-						break;
-						} else if((nibble>>4) != 0x0F) {
-						tmp = 0;
-					}
-
-					mapAddr--;
-				}
-			}
-		}
+	uint16_t const size = freeChunk(heap, addr, owner);
+	if (size != 0) {
+		os_memStats_free(heap, owner, size);
 	}
 }
 
@@ -448,6 +428,10 @@ size_t os_getUseSize(Heap const *heap) {
 
 //! New allocation strategy setter
 void os_setAllocationStrategy(Heap *heap, AllocStrategy newAllocStrat) {
+	// The buddy lists are only kept up to date while the buddy strategy is in use
+	if (newAllocStrat != heap->currAllocStrat) {
+		os_memBuddy_reset(heap);
+	}
 	heap->currAllocStrat = newAllocStrat;
 }
 
@@ -457,7 +441,7 @@ AllocStrategy os_getAllocationStrategy(Heap const *heap) {
 }
 
 // Get the value of the specified nibble address in the heap's memory
-uint8_t getNibbleVal(Heap const* heap, uint8_t nibbleaddr){
+uint8_t getNibbleVal(Heap const* heap, uint16_t nibbleaddr){
 	// Convert the nibble address to the corresponding memory address
 	MemAddr curMemAddr = convertToMemAddr(heap, nibbleaddr);
 	// Read the full byte value from the memory address
@@ -472,27 +456,15 @@ uint8_t getNibbleVal(Heap const* heap, uint8_t nibbleaddr){
 
 // Get the start address of the memory block containing the given address
 uint16_t getStartOfBlock(Heap const* heap, uint16_t addr) {
-	/*while(getNibbleVal(heap, addr) == 0xF){ // While the nibble value is 0xF (indicating a used block)
-		addr--; // Decrement the address
-	}
-	return addr; // Return the start address of the block */
-		while(addr > 0 && getNibble(heap,addr) == 0xf){
-			addr--;
-		}
-		return addr;
+	return os_mapSkipEqualBackward(heap, addr, 0xF);
 }
 
-// Get the size of the memory block at the given address
+// Get the size (in bytes) of the chunk at the given address
 uint16_t os_getChunkSize(Heap const* heap, MemAddr addr){
-	uint16_t temp = addr - heap->firstUseAddr;
-	addr = getStartOfBlock(heap, temp); // Get the start address of the block
-	uint16_t start = addr; // Store the start address
-	
-	do {
-		addr++; // Increment the address
-	} while(getNibbleVal(heap, addr) == 0xF); // While the nibble value is 0xF (indicating a used block)
+	uint16_t start = getStartOfBlock(heap, os_addrToBlock(heap, addr)); // Get the first block of the chunk
 	
-	return (uint16_t)(addr - start); // Calculate and return the size of the block
+	// The chunk goes on as long as the nibble value is 0xF (indicating a used block)
+	return (os_mapSkipEqual(heap, start + 1, heap->blockCount, 0xF) - start) << heap->blockShift;
 }
 
 uint8_t getNibble(Heap const* heap, MemAddr addr){
@@ -505,165 +477,168 @@ uint8_t getNibble(Heap const* heap, MemAddr addr){
 	}
 }
 
+/*!
+ *  Changes the size of a chunk of the current process. The chunk is resized
+ *  in place if possible: It shrinks, grows into the free space behind it, or
+ *  slides down into the free space in front of it (plus behind it). Only if
+ *  none of that fits, it is moved to a new chunk the allocation strategy
+ *  chooses. The contents are kept up to the smaller of both sizes. Under the
+ *  buddy strategy chunks only shrink in place, growing always moves them.
+ *
+ *  \param addr Any address inside the chunk.
+ *  \param size The new size, which must not be 0.
+ *  \return The first address of the resized chunk or 0 if there is no space
+ *          (the chunk is left unchanged then).
+ */
 MemAddr os_realloc(Heap* heap, MemAddr addr, uint16_t size){
 	os_enterCriticalSection();
 	
-	uint16_t nib = (addr - heap->firstUseAddr);
-
-	uint16_t nibbleStartAddr = getStartOfBlock(heap, nib);
-	addr = heap->firstUseAddr + nibbleStartAddr;
-	MemAddr orgAddr = addr;
-
-	ProcessID curProc = os_getCurrentProc();
-	if(curProc == getNibble(heap, nibbleStartAddr)){
-		uint16_t chunkSize = os_getChunkSize(heap, addr);
-
-		if(size == chunkSize){
-
-			} else if(size < chunkSize){
-			for(uint16_t nib = nibbleStartAddr + size; nib < nibbleStartAddr + chunkSize; nib++){
-				MemAddr curMemAddr = convertToMemAddr(heap,nib);
-				MemValue fullByte = heap->driver->read(curMemAddr);
-				if(nib % 2 == 0){
-					fullByte = (fullByte & 0x0f) | (0 << 4);
-					} else {
-					fullByte = (fullByte & 0xf0) | 0;
-				}
-				heap->driver->write(curMemAddr,fullByte);
+	ProcessID const curProc = os_getCurrentProc();
+	uint16_t const start = getStartOfBlock(heap, os_addrToBlock(heap, addr));
+	MemAddr const orgAddr = os_blockToAddr(heap, start);
+	MemAddr result = orgAddr;
+	
+	// Chunks are resized in whole blocks, someone else's chunk is left as it is
+	uint16_t const blocks = os_chunkBlocks(heap, size);
+	uint16_t chunkBlocks = blocks;
+	if(curProc == getNibble(heap, start)){
+		chunkBlocks = os_mapSkipEqual(heap, start + 1, heap->blockCount, 0xF) - start;
+	}
+	uint16_t const end = start + chunkBlocks;
+	uint16_t const chunkSize = chunkBlocks << heap->blockShift;
+	
+	if(size == 0){
+		result = 0;
+	} else if(blocks < chunkBlocks){
+		setNibbleRange(heap, start + blocks, end, 0);
+		releaseBlocks(heap, start + blocks, chunkBlocks - blocks);
+	} else if(blocks > chunkBlocks){
+		// Buddy chunks must stay aligned to their size, so they are always moved
+		bool const inPlace = (os_getAllocationStrategy(heap) != OS_MEM_BUDDY);
+		
+		// The free space behind the chunk is only looked at as far as it is needed
+		uint16_t const limit = (heap->blockCount - start > blocks) ? start + blocks : heap->blockCount;
+		uint16_t const freeEnd = inPlace ? os_mapSkipEqual(heap, end, limit, 0) : end;
+		
+		// The free space in front of the chunk
+		uint16_t newStart = start;
+		if(inPlace && freeEnd - start < blocks && start > 0){
+			newStart = os_mapSkipEqualBackward(heap, start - 1, 0);
+			if(getNibble(heap, newStart) != 0){
+				newStart++;
 			}
-			} else {
-			uint16_t avail = chunkSize;
-			uint16_t curNibbleAddr = nibbleStartAddr + chunkSize;
-			while(getNibble(heap, curNibbleAddr) == 0 && avail < size && curNibbleAddr < heap->sizeUse){
-				avail++;
-				curNibbleAddr++;
+		}
+		uint16_t const newEnd = newStart + blocks;
+		
+		if(freeEnd - start >= blocks){
+			// Grow forward
+			setNibbleRange(heap, end, newEnd, 0xF);
+			os_memIndex_take(heap, end, blocks - chunkBlocks);
+		} else if(freeEnd - newStart >= blocks){
+			// Slide down, the old chunk joins the free space around it and the new one is taken out of it
+			releaseBlocks(heap, start, chunkBlocks);
+			result = os_blockToAddr(heap, newStart);
+			copyBlock(heap, result, orgAddr, chunkSize);
+			
+			setNibble(heap, newStart, curProc);
+			setNibbleRange(heap, newStart + 1, newEnd, 0xF);
+			if(newEnd < end){
+				setNibbleRange(heap, (newEnd > start) ? newEnd : start, end, 0);
 			}
-
-			if(avail >= size){
-				for(uint16_t nib = nibbleStartAddr + chunkSize; nib < curNibbleAddr; nib++){
-					//setNibble(heap, nib, 0xf);
-					MemAddr curMemAddr = convertToMemAddr(heap,nib);
-					MemValue fullByte = heap->driver->read(curMemAddr);
-					if(nib % 2 == 0){
-						fullByte = (fullByte & 0x0f) | (0xf << 4);
-						} else {
-						fullByte = (fullByte & 0xf0) | 0xf;
-					}
-					heap->driver->write(curMemAddr,fullByte);
-				}
-
-				if(heap->lastNibble[curProc] < nibbleStartAddr + size){
-					heap->lastNibble[curProc] = nibbleStartAddr + size;
-				}
-				} else {
-				curNibbleAddr = nibbleStartAddr - 1;
-				while(getNibble(heap, curNibbleAddr) == 0 && curNibbleAddr >= 0){
-					avail++;
-					if(curNibbleAddr == 0){
-						break;
-						} else {
-						curNibbleAddr--;
-					}
-				}
-				if(getNibble(heap, curNibbleAddr) != 0){
-					curNibbleAddr++;
-				}
-				if(avail < size){
-					addr = 0;
-					} else {
-					//addr = getAddrForNibble(heap, curNibbleAddr); 
-					addr = heap->firstUseAddr + curNibbleAddr;
-
-					for(MemAddr offset = 0; offset < chunkSize; offset++){
-						uint8_t byte = heap->driver->read(orgAddr + offset);
-						heap->driver->write(addr + offset, byte);
-					}
-
-					//setNibble(heap, curNibbleAddr, curProc);
-					MemAddr curMemAddr = convertToMemAddr(heap,curNibbleAddr);
-					MemValue fullByte = heap->driver->read(curMemAddr);
-					if(curNibbleAddr % 2 == 0){
-						fullByte = (fullByte & 0x0f) | (curProc << 4);
-						} else {
-						fullByte = (fullByte & 0xf0) | curProc;
-					}
-					heap->driver->write(curMemAddr, fullByte);
-					
-					for(uint16_t nib = curNibbleAddr + 1; nib < (curNibbleAddr + size); nib++){
-						//setNibble(heap, nib, 0xf);
-						MemAddr curMemAddr = convertToMemAddr(heap,nib);
-						MemValue fullByte = heap->driver->read(curMemAddr);
-						if(nib % 2 == 0){
-							fullByte = (fullByte & 0x0f) | (0xf << 4);
-							} else {
-							fullByte = (fullByte & 0xf0) | 0xf;
-						}
-						heap->driver->write(curMemAddr,fullByte);
-					}
-
-					for(uint16_t nib = curNibbleAddr + size; nib < nibbleStartAddr + chunkSize; nib++){
-						//setNibble(heap, nib, 0);
-						MemAddr curMemAddr = convertToMemAddr(heap,nib);
-						MemValue fullByte = heap->driver->read(curMemAddr);
-						if(nib % 2 == 0){
-							fullByte = (fullByte & 0x0f) | (0 << 4);
-							} else {
-							fullByte = (fullByte & 0xf0) | 0;
-						}
-						heap->driver->write(curMemAddr,fullByte);
-					}
-
-					if(heap->lastNibble[curProc] < curNibbleAddr + size){
-						heap->lastNibble[curProc] = curNibbleAddr + size;
-					}
-
-					if(heap->firstNibble[curProc] > curNibbleAddr){
-						heap->firstNibble[curProc] = curNibbleAddr;
-					}
-				}
-
+			os_memIndex_take(heap, newStart, blocks);
+			os_memOwners_move(heap, curProc, start, newStart);
+		} else {
+			// Move, the old chunk is only released once its contents are copied
+			// (its owner entry is handed to the new chunk, so a full row does not overflow)
+			os_memOwners_remove(heap, curProc, start);
+			result = allocChunk(heap, blocks);
+			if(result != 0){
+				copyBlock(heap, result, orgAddr, chunkSize);
+				setNibbleRange(heap, start, end, 0);
+				releaseBlocks(heap, start, chunkBlocks);
+			} else {
+				os_memOwners_add(heap, curProc, start);
 			}
 		}
 	}
-
-	if(addr == 0){
-		addr = os_malloc(heap, size);
-		if(addr != 0){
-			for(uint16_t offset = 0; offset < os_getChunkSize(heap,orgAddr); offset++){
-				uint8_t byte = heap->driver->read(orgAddr + offset);
-				heap->driver->write(addr + offset, byte);
-			}
-			os_free(heap,orgAddr);
-		}
+#if OS_MEM_LAZY_ZERO
+	if(result != 0 && blocks > chunkBlocks){
+		heap->driver->fill(result + chunkSize, 0, (blocks - chunkBlocks) << heap->blockShift);
 	}
-
+#endif
+	os_memStats_alloc(heap, curProc, size, chunkSize, result);
+	
 	os_leaveCriticalSection();
+	
+	return result;
+}
 
-	return addr;
+/*!
+ *  Extends the chunk starting at block start down to block newStart, the
+ *  blocks in between must be free. The compaction then moves the contents
+ *  down piece by piece and gives back the rest with os_trimChunk, so the map
+ *  stays consistent in between. Must be called in a critical section.
+ */
+void os_extendChunkDown(Heap *heap, uint16_t start, uint16_t newStart) {
+	ProcessID const owner = getNibble(heap, start);
+	setNibble(heap, newStart, owner);
+	setNibbleRange(heap, newStart + 1, start + 1, 0xF);
+	os_memIndex_take(heap, newStart, start - newStart);
+	os_memOwners_move(heap, owner, start, newStart);
 }
 
-void os_freeProcessMemory(Heap* heap, ProcessID pid){
-	os_enterCriticalSection();
+/*!
+ *  Releases the blocks of the chunk starting at block start behind its first
+ *  length blocks. Unlike os_free this does not restart the compaction, which
+ *  is the only user. Must be called in a critical section.
+ */
+void os_trimChunk(Heap *heap, uint16_t start, uint16_t length) {
+	uint16_t const end = os_mapSkipEqual(heap, start + 1, heap->blockCount, 0xF);
+	if(start + length < end){
+		setNibbleRange(heap, start + length, end, 0);
+		os_memIndex_release(heap, start + length, end - start - length);
+		os_memBuddy_release(heap, start + length, end - start - length);
+	}
+}
 
-	uint16_t min = heap->firstNibble[pid];
-	uint16_t max = heap->lastNibble[pid];
+//! Releases the chunk starting at block nib of the use area, returns the block behind it
+static uint16_t releaseChunk(Heap *heap, uint16_t nib, uint16_t limit) {
+	uint16_t const chunkEnd = os_mapSkipEqual(heap, nib + 1, limit, 0xF);
+	setNibbleRange(heap, nib, chunkEnd, 0);
+	releaseBlocks(heap, nib, chunkEnd - nib);
+	return chunkEnd;
+}
 
-	for(uint16_t nib = min; nib < max; nib++){
+/*!
+ *  Garbage collection: releases all chunks of pid. The chunks recorded in the
+ *  owner table are visited directly. Only if pid had more chunks than the
+ *  table holds, the whole map is scanned for the rest.
+ */
+void os_freeProcessMemory(Heap* heap, ProcessID pid){
+	os_enterCriticalSection();
+	
+	uint16_t nib;
+	while(os_memOwners_take(heap, pid, &nib)){
+		// The table follows the map, but a chunk that is not pid's anymore is left alone
 		if(getNibble(heap, nib) == pid){
-			do {
-				//setNibble(heap, nib, 0);
-				MemAddr curMemAddr = convertToMemAddr(heap,nib);
-				MemValue fullByte = heap->driver->read(curMemAddr);
-				if(nib % 2 == 0){
-					fullByte = (fullByte & 0x0f) | (0 << 4);
-					} else {
-					fullByte = (fullByte & 0xf0) | 0;
-				}
-				heap->driver->write(curMemAddr,fullByte);
-				nib++;
-			} while(nib < max && getNibble(heap, nib) == 0xf);
-			nib--;
+			releaseChunk(heap, nib, heap->blockCount);
 		}
 	}
+	
+	if(heap->ownedOverflow & (1 << pid)){
+		// Step from chunk to chunk, free runs are skipped at once
+		uint16_t const max = heap->blockCount;
+		for(nib = os_mapSkipEqual(heap, 0, max, 0); nib < max; nib = os_mapSkipEqual(heap, nib, max, 0)){
+			if(getNibble(heap, nib) == pid){
+				nib = releaseChunk(heap, nib, max);
+			} else {
+				nib = os_mapSkipEqual(heap, nib + 1, max, 0xF);
+			}
+		}
+		heap->ownedOverflow &= ~(1 << pid);
+	}
+	
+	os_memHandles_releaseAll(heap, pid);
+	os_memStats_releaseAll(heap, pid);
 	os_leaveCriticalSection();
 }
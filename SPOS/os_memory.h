@@ -48,11 +48,20 @@ void os_setAllocationStrategy(Heap *heap, AllocStrategy allocStrat);
 //! Allocation strategy getter
 AllocStrategy os_getAllocationStrategy(Heap const *heap);
 
-uint8_t getNibbleVal(Heap const* heap, uint8_t nibbleaddr);
+uint8_t getNibbleVal(Heap const* heap, uint16_t nibbleaddr);
 
 //! Frees the chunk only if the owner
 void os_freeAsOwner(Heap *heap, MemAddr addr, ProcessID owner);
 
+//! Extends a chunk down over the free blocks in front of it (used by the compaction)
+void os_extendChunkDown(Heap *heap, uint16_t start, uint16_t newStart);
+
+//! Releases the blocks of a chunk behind its first length blocks (used by the compaction)
+void os_trimChunk(Heap *heap, uint16_t start, uint16_t length);
+
+//! Whether addr is the first address of a chunk of owner
+bool os_isChunkStart(Heap const *heap, MemAddr addr, ProcessID owner);
+
 //! Get the value of a map entry (used by allocation strategies)
 MemValue os_getMapEntry(Heap const *heap, MemAddr addr);
 
@@ -62,5 +71,32 @@ uint16_t os_getChunkSize(Heap const *heap, MemAddr addr);
 //! Get nibble on the address
 uint8_t getNibble(Heap const* heap, MemAddr addr);
 
+//! First nibble in [nib, limit) that differs from value (0x0 or 0xF), limit if there is none
+uint16_t os_mapSkipEqual(Heap const *heap, uint16_t nib, uint16_t limit, MemValue value);
+
+//! Last nibble up to nib that differs from value (0x0 or 0xF), 0 if there is none
+uint16_t os_mapSkipEqualBackward(Heap const *heap, uint16_t nib, MemValue value);
+
+//! First free nibble in [nib, limit), limit if there is none
+uint16_t os_mapSkipUsed(Heap const *heap, uint16_t nib, uint16_t limit);
+
+//! Block (map nibble) of the use area that holds the given address
+static inline uint16_t os_addrToBlock(Heap const *heap, MemAddr addr) {
+	return (addr - heap->firstUseAddr) >> heap->blockShift;
+}
+
+//! First address of a block of the use area
+static inline MemAddr os_blockToAddr(Heap const *heap, uint16_t block) {
+	return heap->firstUseAddr + ((MemAddr)block << heap->blockShift);
+}
+
+//! Number of blocks needed to hold size bytes
+static inline uint16_t os_bytesToBlocks(Heap const *heap, size_t size) {
+	return ((uint32_t)size + (1u << heap->blockShift) - 1) >> heap->blockShift;
+}
+
+//! Number of blocks os_malloc takes for size bytes (rounded up further by the buddy strategy)
+uint16_t os_chunkBlocks(Heap const *heap, size_t size);
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,162 @@
+/*
+ * os_memory_arena.c
+ *
+ * Every chunk of an arena is described by an ArenaChunk at its start. The
+ * first chunk additionally holds an ArenaHeader in front of its descriptor,
+ * which names the chunk that allocations currently come from. Allocating
+ * only moves the top of that chunk, so neither the map nor the strategies
+ * are involved until the chunk is full. Then the next chunk of the chain is
+ * used, or a new one is allocated and appended.
+ *
+ * A reset only points the arena back at its first chunk. The following
+ * chunks stay in the chain and are emptied once allocations reach them.
+ */
+
+#include "os_memory_arena.h"
+#include "os_memory.h"
+#include "os_core.h"
+
+
+//! Descriptor of a chunk of an arena
+typedef struct {
+	MemAddr next;		//!< Descriptor of the next chunk, 0 at the end of the chain
+	uint16_t top;		//!< Offset of the first unused byte from the descriptor on
+	uint16_t size;		//!< Bytes from the descriptor to the end of the chunk
+} ArenaChunk;
+
+//! Bookkeeping at the start of the first chunk
+typedef struct {
+	MemAddr current;	//!< Descriptor of the chunk allocations are taken from
+	uint16_t growSize;	//!< Size of further chunks
+	ArenaChunk first;
+} ArenaHeader;
+
+//! Descriptor of the first chunk of an arena
+#define FIRST_CHUNK(arena) ((arena) + offsetof(ArenaHeader, first))
+
+
+// ---------------------------------------------------
+//	Private Functions
+// ---------------------------------------------------
+
+static void readChunk(Heap const *heap, MemAddr desc, ArenaChunk *chunk) {
+	heap->driver->readBlock(desc, (MemValue*)chunk, sizeof(*chunk));
+}
+
+static void writeChunk(Heap const *heap, MemAddr desc, ArenaChunk const *chunk) {
+	heap->driver->writeBlock(desc, (MemValue const*)chunk, sizeof(*chunk));
+}
+
+static void writeCurrent(Heap const *heap, MemAddr arena, MemAddr desc) {
+	heap->driver->writeBlock(arena + offsetof(ArenaHeader, current), (MemValue const*)&desc, sizeof(desc));
+}
+
+
+// ---------------------------------------------------
+//	Public Functions
+// ---------------------------------------------------
+
+/*!
+ *  Allocates the first chunk of the arena.
+ *
+ *  \param size Bytes the first chunk and every further one holds at least.
+ *  \return The address of the arena, which identifies it in the other calls, or 0.
+ */
+MemAddr os_arenaCreate(Heap *heap, uint16_t size) {
+	if (size == 0 || (uint32_t)size + sizeof(ArenaHeader) > heap->sizeUse) {
+		return 0;
+	}
+
+	os_enterCriticalSection();
+	MemAddr const arena = os_malloc(heap, sizeof(ArenaHeader) + size);
+	if (arena != 0) {
+		ArenaHeader const header = {
+			FIRST_CHUNK(arena),
+			size,
+			{0, sizeof(ArenaChunk), sizeof(ArenaChunk) + size}
+		};
+		heap->driver->writeBlock(arena, (MemValue const*)&header, sizeof(header));
+	}
+	os_leaveCriticalSection();
+	return arena;
+}
+
+/*!
+ *  Bumps the top of the current chunk. If the request does not fit, the
+ *  arena moves on to the next chunk of the chain or appends a new chunk
+ *  that holds at least size bytes.
+ */
+MemAddr os_arenaAlloc(Heap *heap, MemAddr arena, uint16_t size) {
+	MemAddr result = 0;
+
+	os_enterCriticalSection();
+	if (size != 0 && os_isChunkStart(heap, arena, os_getCurrentProc())) {
+		MemAddr desc;
+		ArenaChunk chunk;
+		heap->driver->readBlock(arena + offsetof(ArenaHeader, current), (MemValue*)&desc, sizeof(desc));
+		readChunk(heap, desc, &chunk);
+
+		while (chunk.size - chunk.top < size) {
+			MemAddr next = chunk.next;
+			if (next == 0) {
+				uint16_t growSize;
+				heap->driver->readBlock(arena + offsetof(ArenaHeader, growSize), (MemValue*)&growSize, sizeof(growSize));
+				uint32_t const bytes = sizeof(ArenaChunk) + ((size > growSize) ? size : growSize);
+				next = (bytes <= heap->sizeUse) ? os_malloc(heap, bytes) : 0;
+				if (next == 0) {
+					break;
+				}
+				chunk.next = next;
+				writeChunk(heap, desc, &chunk);
+				chunk.next = 0;
+				chunk.size = bytes;
+			} else {
+				readChunk(heap, next, &chunk);
+			}
+			// Chunks behind the current one hold nothing since the last reset
+			chunk.top = sizeof(ArenaChunk);
+			desc = next;
+			writeChunk(heap, desc, &chunk);
+			writeCurrent(heap, arena, desc);
+		}
+
+		if (chunk.size - chunk.top >= size) {
+			result = desc + chunk.top;
+			chunk.top += size;
+			writeChunk(heap, desc, &chunk);
+#if OS_MEM_LAZY_ZERO
+			heap->driver->fill(result, 0, size);
+#endif
+		}
+	}
+	os_leaveCriticalSection();
+	return result;
+}
+
+//! Points the arena back at the empty first chunk, in constant time
+void os_arenaReset(Heap *heap, MemAddr arena) {
+	os_enterCriticalSection();
+	if (os_isChunkStart(heap, arena, os_getCurrentProc())) {
+		uint16_t const top = sizeof(ArenaChunk);
+		writeCurrent(heap, arena, FIRST_CHUNK(arena));
+		heap->driver->writeBlock(FIRST_CHUNK(arena) + offsetof(ArenaChunk, top), (MemValue const*)&top, sizeof(top));
+	}
+	os_leaveCriticalSection();
+}
+
+//! Frees the chained chunks one by one and the first chunk last
+void os_arenaDestroy(Heap *heap, MemAddr arena) {
+	os_enterCriticalSection();
+	if (os_isChunkStart(heap, arena, os_getCurrentProc())) {
+		MemAddr desc;
+		heap->driver->readBlock(FIRST_CHUNK(arena) + offsetof(ArenaChunk, next), (MemValue*)&desc, sizeof(desc));
+		while (desc != 0) {
+			MemAddr next;
+			heap->driver->readBlock(desc + offsetof(ArenaChunk, next), (MemValue*)&next, sizeof(next));
+			os_free(heap, desc);
+			desc = next;
+		}
+		os_free(heap, arena);
+	}
+	os_leaveCriticalSection();
+}
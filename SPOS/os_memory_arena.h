@@ -0,0 +1,29 @@
+/*
+ * os_memory_arena.h
+ *
+ * Arenas hand out memory by bumping an offset inside chunks of the process
+ * that creates them and release all of it at once. They grow by chaining
+ * further chunks, which os_kill releases like any other chunk.
+ */
+
+
+#ifndef _OS_MEMORY_ARENA_H
+#define _OS_MEMORY_ARENA_H
+
+#include "os_memheap_drivers.h"
+
+
+//! Creates an arena for the current process whose chunks hold size bytes at least, returns 0 if there is no space
+MemAddr os_arenaCreate(Heap *heap, uint16_t size);
+
+//! Takes size bytes from the arena, returns 0 if there is no space
+MemAddr os_arenaAlloc(Heap *heap, MemAddr arena, uint16_t size);
+
+//! Gives back everything allocated from the arena, its chunks are kept for reuse
+void os_arenaReset(Heap *heap, MemAddr arena);
+
+//! Releases the arena and all of its chunks
+void os_arenaDestroy(Heap *heap, MemAddr arena);
+
+
+#endif
@@ -0,0 +1,250 @@
+/*
+ * os_memory_buddy.c
+ *
+ * Every free block of the buddy strategy has an order k: it spans 2^k blocks
+ * of the map and starts at a multiple of 2^k. The free blocks of each order
+ * form a doubly linked list whose nodes live in the first bytes of the blocks
+ * themselves, only the list heads are kept in the Heap. Therefore the
+ * smallest block must hold a BuddyNode.
+ *
+ * The map stays the owner of the truth: os_malloc and os_free mark chunks in
+ * it as with every other strategy, so the garbage collection and the other
+ * strategies keep working. The lists are only maintained while OS_MEM_BUDDY
+ * is the strategy of the heap and are rebuilt from the map once it is chosen.
+ *
+ * A free block may be merged with its buddy if the map shows the first block
+ * of the buddy as free and its node carries the same order. This is reliable
+ * because every free position the merge looks at either starts a listed
+ * block or a piece that is too small for the lists, whose first byte is
+ * marked with NO_ORDER. Such pieces are lost for the buddy strategy until an
+ * allocation fails, which rebuilds the lists from the map.
+ */
+
+#include "os_memory_buddy.h"
+#include "os_memory.h"
+#include "os_memory_index.h"
+
+
+//! End of a free list
+#define NONE OS_MEM_BUDDY_NONE
+
+//! Order byte of a position that does not start a listed free block
+#define NO_ORDER 0xFF
+
+//! Node at the start of every listed free block
+typedef struct {
+	uint8_t order;
+	uint16_t next;
+	uint16_t prev;
+} BuddyNode;
+
+
+// ---------------------------------------------------
+//	Private Functions
+// ---------------------------------------------------
+
+//! Order of the smallest block that can hold a BuddyNode
+static uint8_t minOrder(Heap const *heap) {
+	uint8_t order = 0;
+	while (((uint16_t)1 << (order + heap->blockShift)) < sizeof(BuddyNode)) {
+		order++;
+	}
+	return order;
+}
+
+//! Order of the largest aligned block that starts at start and ends at end at the latest
+static uint8_t pieceOrder(uint16_t start, uint16_t end) {
+	uint8_t order = 0;
+	while (order + 1 < OS_MEM_BUDDY_ORDERS && !(start & (1u << order)) && end - start >= (2u << order)) {
+		order++;
+	}
+	return order;
+}
+
+static void readNode(Heap const *heap, uint16_t block, BuddyNode *node) {
+	heap->driver->readBlock(os_blockToAddr(heap, block), (MemValue*)node, sizeof(*node));
+}
+
+static void writeLink(Heap const *heap, uint16_t block, uint8_t offset, uint16_t value) {
+	heap->driver->writeBlock(os_blockToAddr(heap, block) + offset, (MemValue const*)&value, sizeof(value));
+}
+
+//! Puts a free block in front of the list of its order
+static void push(Heap *heap, uint16_t block, uint8_t order) {
+	BuddyNode const node = {order, heap->buddyFree[order], NONE};
+
+	if (node.next != NONE) {
+		writeLink(heap, node.next, offsetof(BuddyNode, prev), block);
+	}
+	heap->driver->writeBlock(os_blockToAddr(heap, block), (MemValue const*)&node, sizeof(node));
+	heap->buddyFree[order] = block;
+}
+
+//! Takes the block with the given node out of its list
+static void unlink(Heap *heap, BuddyNode const *node) {
+	if (node->prev != NONE) {
+		writeLink(heap, node->prev, offsetof(BuddyNode, next), node->next);
+	} else {
+		heap->buddyFree[node->order] = node->next;
+	}
+	if (node->next != NONE) {
+		writeLink(heap, node->next, offsetof(BuddyNode, prev), node->prev);
+	}
+}
+
+/*!
+ *  Splits [start, end) into the largest aligned blocks and lists them
+ *  without merging. Pieces below the smallest order are only marked.
+ */
+static void insertRange(Heap *heap, uint16_t start, uint16_t end) {
+	uint8_t const smallest = minOrder(heap);
+
+	while (start < end) {
+		uint8_t const order = pieceOrder(start, end);
+		if (order >= smallest) {
+			push(heap, start, order);
+		} else {
+			heap->driver->write(os_blockToAddr(heap, start), NO_ORDER);
+			heap->buddyLost = true;
+		}
+		start += 1u << order;
+	}
+}
+
+//! Merges a listed block with its buddies as long as they are free
+static void coalesce(Heap *heap, uint16_t block, uint8_t order) {
+	BuddyNode node;
+	readNode(heap, block, &node);
+	if (node.order != order) {
+		// Already merged into a neighbouring block of the same range
+		return;
+	}
+	unlink(heap, &node);
+
+	while (order + 1 < OS_MEM_BUDDY_ORDERS) {
+		uint16_t const size = 1u << order;
+		uint16_t const buddy = block ^ size;
+		if (size > heap->blockCount || buddy > heap->blockCount - size || getNibble(heap, buddy) != 0) {
+			break;
+		}
+		readNode(heap, buddy, &node);
+		if (node.order != order) {
+			break;
+		}
+		unlink(heap, &node);
+		heap->driver->write(os_blockToAddr(heap, block | size), NO_ORDER);
+		block &= ~size;
+		order++;
+	}
+	push(heap, block, order);
+}
+
+//! Lists the free runs of the map, taken from the free run index if it holds all of them
+static void rebuild(Heap *heap) {
+	for (uint8_t order = 0; order < OS_MEM_BUDDY_ORDERS; order++) {
+		heap->buddyFree[order] = NONE;
+	}
+	heap->buddyLost = false;
+
+	// The largest aligned blocks of maximal free runs never have a free buddy
+	if (os_memIndex_ready(heap)) {
+		for (uint8_t i = 0; i < heap->freeRunCount; i++) {
+			insertRange(heap, heap->freeRuns[i].start, heap->freeRuns[i].start + heap->freeRuns[i].length);
+		}
+	} else {
+		uint16_t start = os_mapSkipUsed(heap, 0, heap->blockCount);
+		while (start < heap->blockCount) {
+			uint16_t const end = os_mapSkipEqual(heap, start, heap->blockCount, 0);
+			insertRange(heap, start, end);
+			start = os_mapSkipUsed(heap, end, heap->blockCount);
+		}
+	}
+	heap->buddyValid = true;
+}
+
+//! First non-empty list from the given order on, OS_MEM_BUDDY_ORDERS if there is none
+static uint8_t findOrder(Heap const *heap, uint8_t order) {
+	while (order < OS_MEM_BUDDY_ORDERS && heap->buddyFree[order] == NONE) {
+		order++;
+	}
+	return order;
+}
+
+
+// ---------------------------------------------------
+//	Public Functions
+// ---------------------------------------------------
+
+void os_memBuddy_reset(Heap *heap) {
+	heap->buddyValid = false;
+}
+
+//! Rounds up to a power of two, but at least the smallest block
+uint16_t os_memBuddy_blocks(Heap const *heap, uint16_t blocks) {
+	uint8_t order = minOrder(heap);
+	while ((1u << order) < blocks) {
+		if (++order == OS_MEM_BUDDY_ORDERS) {
+			return UINT16_MAX;
+		}
+	}
+	return 1u << order;
+}
+
+/*!
+ *  Takes the first block of the smallest order that fits and splits it down
+ *  to the requested size, the upper halves go back to the lists.
+ *
+ *  \return The first block of the chunk (relative to the use area) or
+ *          OS_MEM_BUDDY_NONE if there is no space.
+ */
+uint16_t os_memBuddy_alloc(Heap *heap, uint16_t blocks) {
+	if (!heap->buddyValid) {
+		rebuild(heap);
+	}
+
+	uint8_t order = 0;
+	while ((1u << order) < blocks) {
+		order++;
+	}
+
+	uint8_t found = findOrder(heap, order);
+	if (found == OS_MEM_BUDDY_ORDERS && heap->buddyLost) {
+		// Pieces too small for the lists may add up to a fitting block by now
+		rebuild(heap);
+		found = findOrder(heap, order);
+	}
+	if (found == OS_MEM_BUDDY_ORDERS) {
+		return NONE;
+	}
+
+	uint16_t const block = heap->buddyFree[found];
+	BuddyNode node;
+	readNode(heap, block, &node);
+	unlink(heap, &node);
+	while (found > order) {
+		found--;
+		push(heap, block + (1u << found), found);
+	}
+	return block;
+}
+
+/*!
+ *  Lists a range that was just freed in the map. All of its blocks get their
+ *  nodes first, so merging never looks at a free position without one.
+ */
+void os_memBuddy_release(Heap *heap, uint16_t start, uint16_t length) {
+	if (!heap->buddyValid) {
+		return;
+	}
+	uint16_t const end = start + length;
+	uint8_t const smallest = minOrder(heap);
+
+	insertRange(heap, start, end);
+	while (start < end) {
+		uint8_t const order = pieceOrder(start, end);
+		if (order >= smallest) {
+			coalesce(heap, start, order);
+		}
+		start += 1u << order;
+	}
+}
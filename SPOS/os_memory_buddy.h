@@ -0,0 +1,32 @@
+/*
+ * os_memory_buddy.h
+ *
+ * Free lists of the buddy allocation strategy (OS_MEM_BUDDY). Chunks are
+ * power-of-two blocks aligned to their size, so allocating and freeing only
+ * walks the OS_MEM_BUDDY_ORDERS orders instead of the map.
+ */
+
+
+#ifndef _OS_MEMORY_BUDDY_H
+#define _OS_MEMORY_BUDDY_H
+
+#include "os_memheap_drivers.h"
+
+
+//! Result of os_memBuddy_alloc if no block is free
+#define OS_MEM_BUDDY_NONE 0xFFFF
+
+//! Forgets the free lists, they are rebuilt from the map at the next allocation
+void os_memBuddy_reset(Heap *heap);
+
+//! Number of blocks a buddy chunk needs to hold the given number of blocks, UINT16_MAX if there is no such chunk
+uint16_t os_memBuddy_blocks(Heap const *heap, uint16_t blocks);
+
+//! Takes a free block of the given size (a result of os_memBuddy_blocks) out of the lists
+uint16_t os_memBuddy_alloc(Heap *heap, uint16_t blocks);
+
+//! Adds a freed range (relative to the use area) to the lists and merges it with its buddies
+void os_memBuddy_release(Heap *heap, uint16_t start, uint16_t length);
+
+
+#endif
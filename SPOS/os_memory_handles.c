@@ -0,0 +1,239 @@
+/*
+ * os_memory_handles.c
+ *
+ * Every heap has a table of OS_MEM_HANDLES entries. A handle is the index of
+ * its entry plus one, the entry holds the current address of the chunk, its
+ * owner and the number of locks on it.
+ *
+ * The compaction walks the map from compactCursor on. Each step looks at the
+ * next free run and the chunk right behind it. If that chunk belongs to an
+ * unlocked handle, it is extended down over the run and its contents are
+ * moved down COMPACT_PIECE bytes per step, then the blocks left behind it
+ * are given back. Otherwise it is skipped. A handle call on the chunk that
+ * is being moved finishes the move first. Once the walk reaches the end of
+ * the map, the compaction is done until blocks are freed or a handle is
+ * unlocked again, as long as there is an unlocked handle at all. The buddy
+ * strategy keeps its chunks aligned, so its heaps are not compacted.
+ */
+
+#include "os_memory_handles.h"
+#include "os_memory.h"
+#include "os_core.h"
+
+#if OS_MEM_HANDLES
+
+//! Bytes the compaction moves per step, which bounds the time it holds off the scheduler
+#define COMPACT_PIECE 32
+
+
+// ---------------------------------------------------
+//	Private Functions
+// ---------------------------------------------------
+
+//! Entry of a handle of the current process, NULL if there is none
+static HandleEntry* entryOf(Heap *heap, MemHandle handle) {
+	if (handle == 0 || handle > OS_MEM_HANDLES) {
+		return NULL;
+	}
+	HandleEntry *entry = &heap->handles[handle - 1];
+	return (entry->addr != 0 && entry->owner == os_getCurrentProc()) ? entry : NULL;
+}
+
+//! Entry whose chunk starts at addr, NULL if it is no handle chunk
+static HandleEntry* entryAt(Heap *heap, MemAddr addr) {
+	for (uint8_t i = 0; i < OS_MEM_HANDLES; i++) {
+		if (heap->handles[i].addr == addr) {
+			return &heap->handles[i];
+		}
+	}
+	return NULL;
+}
+
+//! Restarts the compaction if some chunk may be moved
+static void arm(Heap *heap) {
+	for (uint8_t i = 0; i < OS_MEM_HANDLES; i++) {
+		if (heap->handles[i].addr != 0 && heap->handles[i].locks == 0) {
+			heap->compactCursor = 0;
+			heap->compactPending = true;
+			return;
+		}
+	}
+}
+
+//! Moves the next piece of the chunk the compaction is moving, and finishes the move after the last one
+static void moveStep(Heap *heap) {
+	HandleEntry *entry = &heap->handles[heap->compactHandle - 1];
+	MemAddr const to = os_blockToAddr(heap, heap->compactTo);
+	uint16_t const left = heap->compactLength - heap->compactCopied;
+	uint16_t const piece = (left < COMPACT_PIECE) ? left : COMPACT_PIECE;
+	MemValue buffer[COMPACT_PIECE];
+
+	// The chunk moves down, so the bytes a piece overwrites have been moved already
+	heap->driver->readBlock(entry->addr + heap->compactCopied, buffer, piece);
+	heap->driver->writeBlock(to + heap->compactCopied, buffer, piece);
+	heap->compactCopied += piece;
+
+	if (heap->compactCopied == heap->compactLength) {
+		os_trimChunk(heap, heap->compactTo, heap->compactLength >> heap->blockShift);
+		entry->addr = to;
+		heap->compactHandle = 0;
+	}
+}
+
+//! Completes the move of the chunk of entry, if the compaction is moving it
+static void finishMove(Heap *heap, HandleEntry const *entry) {
+	if (heap->compactHandle != 0 && &heap->handles[heap->compactHandle - 1] == entry) {
+		while (heap->compactHandle != 0) {
+			moveStep(heap);
+		}
+	}
+}
+
+
+// ---------------------------------------------------
+//	Public Functions
+// ---------------------------------------------------
+
+MemHandle os_hmalloc(Heap *heap, size_t size) {
+	MemHandle handle = 0;
+
+	os_enterCriticalSection();
+	for (uint8_t i = 0; i < OS_MEM_HANDLES; i++) {
+		HandleEntry *entry = &heap->handles[i];
+		if (entry->addr == 0) {
+			entry->addr = os_malloc(heap, size);
+			if (entry->addr != 0) {
+				entry->owner = os_getCurrentProc();
+				entry->locks = 0;
+				handle = i + 1;
+				arm(heap);
+			}
+			break;
+		}
+	}
+	os_leaveCriticalSection();
+	return handle;
+}
+
+MemAddr os_hlock(Heap *heap, MemHandle handle) {
+	MemAddr addr = 0;
+
+	os_enterCriticalSection();
+	HandleEntry *entry = entryOf(heap, handle);
+	if (entry) {
+		if (entry->locks == UINT8_MAX) {
+			os_error("Handle locked too often");
+		}
+		finishMove(heap, entry);
+		entry->locks++;
+		addr = entry->addr;
+	}
+	os_leaveCriticalSection();
+	return addr;
+}
+
+void os_hunlock(Heap *heap, MemHandle handle) {
+	os_enterCriticalSection();
+	HandleEntry *entry = entryOf(heap, handle);
+	if (entry && entry->locks > 0 && --entry->locks == 0) {
+		arm(heap);
+	}
+	os_leaveCriticalSection();
+}
+
+void os_hfree(Heap *heap, MemHandle handle) {
+	os_enterCriticalSection();
+	HandleEntry *entry = entryOf(heap, handle);
+	if (entry) {
+		finishMove(heap, entry);
+		os_free(heap, entry->addr);
+		entry->addr = 0;
+	}
+	os_leaveCriticalSection();
+}
+
+/*!
+ *  Resizes the chunk of a handle like os_realloc. The chunk may move, so the
+ *  address of a locked handle has to be fetched again with os_hlock.
+ *
+ *  \return True if the chunk has the new size, false if it was left as it is.
+ */
+bool os_hrealloc(Heap *heap, MemHandle handle, size_t size) {
+	bool resized = false;
+
+	os_enterCriticalSection();
+	HandleEntry *entry = entryOf(heap, handle);
+	if (entry) {
+		finishMove(heap, entry);
+		MemAddr const addr = os_realloc(heap, entry->addr, size);
+		if (addr != 0) {
+			entry->addr = addr;
+			resized = true;
+		}
+	}
+	os_leaveCriticalSection();
+	return resized;
+}
+
+/*!
+ *  One step of the compaction, meant to be called by the idle process
+ *  until it returns false. Every step only scans up to the next chunk or
+ *  moves COMPACT_PIECE bytes.
+ */
+bool os_memCompact(Heap *heap) {
+	os_enterCriticalSection();
+	if (heap->compactHandle != 0) {
+		moveStep(heap);
+	} else if (heap->compactPending && os_getAllocationStrategy(heap) != OS_MEM_BUDDY) {
+		uint16_t const gap = os_mapSkipUsed(heap, heap->compactCursor, heap->blockCount);
+		uint16_t const chunk = os_mapSkipEqual(heap, gap, heap->blockCount, 0);
+
+		if (chunk == heap->blockCount) {
+			heap->compactCursor = 0;
+			heap->compactPending = false;
+		} else {
+			HandleEntry *entry = entryAt(heap, os_blockToAddr(heap, chunk));
+			if (entry && entry->locks == 0) {
+				uint16_t const end = os_mapSkipEqual(heap, chunk + 1, heap->blockCount, 0xF);
+				os_extendChunkDown(heap, chunk, gap);
+				heap->compactHandle = entry - heap->handles + 1;
+				heap->compactTo = gap;
+				heap->compactLength = (end - chunk) << heap->blockShift;
+				heap->compactCopied = 0;
+				heap->compactCursor = gap + 1;
+			} else {
+				heap->compactCursor = chunk + 1;
+			}
+		}
+	}
+	bool const pending = heap->compactPending || heap->compactHandle != 0;
+	os_leaveCriticalSection();
+	return pending;
+}
+
+void os_memHandles_reset(Heap *heap) {
+	for (uint8_t i = 0; i < OS_MEM_HANDLES; i++) {
+		heap->handles[i].addr = 0;
+	}
+	heap->compactCursor = 0;
+	heap->compactPending = false;
+	heap->compactHandle = 0;
+}
+
+//! The chunks were released with the rest of pid's memory, including one the compaction was moving
+void os_memHandles_releaseAll(Heap *heap, ProcessID pid) {
+	for (uint8_t i = 0; i < OS_MEM_HANDLES; i++) {
+		if (heap->handles[i].addr != 0 && heap->handles[i].owner == pid) {
+			heap->handles[i].addr = 0;
+			if (heap->compactHandle == i + 1) {
+				heap->compactHandle = 0;
+			}
+		}
+	}
+}
+
+void os_memHandles_released(Heap *heap) {
+	arm(heap);
+}
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * os_memory_handles.h
+ *
+ * Movable chunks. os_hmalloc returns a handle instead of an address, and
+ * the address is only valid between os_hlock and os_hunlock. In between,
+ * the idle process compacts the heaps with os_memCompact by sliding
+ * unlocked handle chunks down into the free space in front of them, so
+ * large allocations keep succeeding on a long-running system.
+ *
+ * Handle chunks must only be resized and freed through this interface.
+ * Without OS_MEM_HANDLES the interface is not compiled.
+ */
+
+
+#ifndef _OS_MEMORY_HANDLES_H
+#define _OS_MEMORY_HANDLES_H
+
+#include "os_memheap_drivers.h"
+#include "os_process.h"
+
+#include <stdbool.h>
+
+
+//! A movable chunk, 0 is no handle
+typedef uint8_t MemHandle;
+
+#if OS_MEM_HANDLES
+
+//! Allocates a movable chunk for the current process, returns 0 if there is no space or no free handle
+MemHandle os_hmalloc(Heap *heap, size_t size);
+
+//! Pins the chunk and returns its address, 0 if the handle is not one of the current process
+MemAddr os_hlock(Heap *heap, MemHandle handle);
+
+//! Releases one os_hlock, the chunk may move once all of them are released
+void os_hunlock(Heap *heap, MemHandle handle);
+
+//! Frees the chunk of the handle, even if it is still locked
+void os_hfree(Heap *heap, MemHandle handle);
+
+//! Resizes the chunk of the handle, returns false if there is no space
+bool os_hrealloc(Heap *heap, MemHandle handle, size_t size);
+
+//! Scans for the next chunk or moves a piece of it, returns whether the compaction has more work to do
+bool os_memCompact(Heap *heap);
+
+//! Forgets all handles of the heap
+void os_memHandles_reset(Heap *heap);
+
+//! Forgets the handles of pid, whose chunks the garbage collection releases
+void os_memHandles_releaseAll(Heap *heap, ProcessID pid);
+
+//! Hook: blocks were freed in the map, so the compaction starts over if there is an unlocked handle
+void os_memHandles_released(Heap *heap);
+
+#else
+
+#define os_memCompact(heap) false
+#define os_memHandles_reset(heap) ((void)0)
+#define os_memHandles_releaseAll(heap, pid) ((void)0)
+#define os_memHandles_released(heap) ((void)0)
+
+#endif
+
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ * os_memory_index.c
+ *
+ * The free run index holds up to freeRunCapacity maximal runs of free
+ * nibbles, sorted by their start. The capacity is set per heap
+ * (OS_INT_HEAP_FREE_RUNS, OS_EXT_HEAP_FREE_RUNS), so the index covers the
+ * fragmentation a heap of that size sees in practice. os_malloc, os_free, os_realloc and the
+ * garbage collection report every range they allocate or free, so the
+ * strategies can answer in time proportional to the number of free runs.
+ *
+ * If a heap is fragmented into more runs than the index can hold, the index
+ * is marked invalid and only the number of runs is tracked (by looking at the
+ * two neighbours of each range in the map). As soon as the count drops back
+ * to the capacity, the index is rebuilt from the map once.
+ */
+
+#include "os_memory_index.h"
+#include "os_memory.h"
+
+
+// ---------------------------------------------------
+//	Private Functions
+// ---------------------------------------------------
+
+//! Whether the nibble at the given position of the use area exists and is free
+static bool isFreeNibble(Heap const *heap, uint16_t nib) {
+	return nib < heap->blockCount && getNibble(heap, nib) == 0;
+}
+
+//! Forgets the index, it is rebuilt at the next allocation
+static void invalidate(Heap *heap) {
+	heap->freeRunsValid = false;
+	heap->freeRunCount = 0;
+}
+
+//! Number of runs that start at or before nib, found by bisection
+static uint8_t runsUpTo(Heap const *heap, uint16_t nib) {
+	uint8_t low = 0;
+	uint8_t high = heap->freeRunCount;
+	while (low < high) {
+		uint8_t const mid = low + (high - low) / 2;
+		if (heap->freeRuns[mid].start <= nib) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+//! Inserts a run at the given position, which must be free
+static void insertRun(Heap *heap, uint8_t pos, uint16_t start, uint16_t length) {
+	for (uint8_t i = heap->freeRunCount; i > pos; i--) {
+		heap->freeRuns[i] = heap->freeRuns[i - 1];
+	}
+	heap->freeRuns[pos].start = start;
+	heap->freeRuns[pos].length = length;
+	heap->freeRunCount++;
+}
+
+//! Removes the run at the given position
+static void removeRun(Heap *heap, uint8_t pos) {
+	heap->freeRunCount--;
+	for (uint8_t i = pos; i < heap->freeRunCount; i++) {
+		heap->freeRuns[i] = heap->freeRuns[i + 1];
+	}
+}
+
+//! Scans the map run by run and collects its free runs
+static void rebuild(Heap *heap) {
+	uint16_t count = 0;
+	uint16_t start = os_mapSkipUsed(heap, 0, heap->blockCount);
+
+	while (start < heap->blockCount) {
+		uint16_t const end = os_mapSkipEqual(heap, start, heap->blockCount, 0);
+		if (count < heap->freeRunCapacity) {
+			heap->freeRuns[count].start = start;
+			heap->freeRuns[count].length = end - start;
+		}
+		count++;
+		start = os_mapSkipUsed(heap, end, heap->blockCount);
+	}
+
+	heap->freeRunCount = count;
+	heap->freeRunsValid = (count <= heap->freeRunCapacity);
+}
+
+
+// ---------------------------------------------------
+//	Public Functions
+// ---------------------------------------------------
+
+//! Marks the whole use area of the heap as one free run
+void os_memIndex_reset(Heap *heap) {
+	heap->freeRuns[0].start = 0;
+	heap->freeRuns[0].length = heap->blockCount;
+	heap->freeRunCount = 1;
+	heap->freeRunsValid = true;
+}
+
+/*!
+ *  Removes an allocated range from the index. The range must lie inside one
+ *  free run. Its neighbours in the map must already show the state after the
+ *  allocation, the range itself may or may not be written yet.
+ */
+void os_memIndex_take(Heap *heap, uint16_t start, uint16_t length) {
+	if (length == 0) {
+		return;
+	}
+	uint16_t const end = start + length;
+
+	if (!heap->freeRunsValid) {
+		if (heap->freeRunCount != 0) {
+			// One run less, unless it is split in two or shortened
+			heap->freeRunCount += (start > 0 && isFreeNibble(heap, start - 1)) + isFreeNibble(heap, end);
+			heap->freeRunCount--;
+		}
+		return;
+	}
+
+	// The only run that may hold the range is the last one starting at or before it
+	uint8_t const i = runsUpTo(heap, start) - 1;
+	if (i == UINT8_MAX || end > heap->freeRuns[i].start + heap->freeRuns[i].length) {
+		// The index does not match the map anymore
+		invalidate(heap);
+		return;
+	}
+
+	FreeRun *run = &heap->freeRuns[i];
+	uint16_t const runEnd = run->start + run->length;
+	bool const left = (start > run->start);
+	bool const right = (end < runEnd);
+
+	if (left && right) {
+		if (heap->freeRunCount == heap->freeRunCapacity) {
+			heap->freeRunsValid = false;
+			heap->freeRunCount++;
+			return;
+		}
+		run->length = start - run->start;
+		insertRun(heap, i + 1, end, runEnd - end);
+	} else if (left) {
+		run->length = start - run->start;
+	} else if (right) {
+		run->start = end;
+		run->length = runEnd - end;
+	} else {
+		removeRun(heap, i);
+	}
+}
+
+/*!
+ *  Adds a freed range to the index and merges it with adjacent runs. Its
+ *  neighbours in the map must show the state after the release, the range
+ *  itself may or may not be written yet.
+ */
+void os_memIndex_release(Heap *heap, uint16_t start, uint16_t length) {
+	if (length == 0) {
+		return;
+	}
+	uint16_t const end = start + length;
+
+	if (!heap->freeRunsValid) {
+		if (heap->freeRunCount != 0) {
+			// One run more, unless it joins one or two existing runs
+			heap->freeRunCount++;
+			heap->freeRunCount -= (start > 0 && isFreeNibble(heap, start - 1)) + isFreeNibble(heap, end);
+		}
+		return;
+	}
+
+	// Position of the first run behind the released range
+	uint8_t const i = runsUpTo(heap, start);
+
+	FreeRun *prev = (i > 0) ? &heap->freeRuns[i - 1] : NULL;
+	FreeRun *next = (i < heap->freeRunCount) ? &heap->freeRuns[i] : NULL;
+
+	// Releasing memory that is already free means the index is off
+	if ((prev && prev->start + prev->length > start) || (next && next->start < end)) {
+		invalidate(heap);
+		return;
+	}
+
+	bool const joinPrev = prev && (prev->start + prev->length == start);
+	bool const joinNext = next && (next->start == end);
+
+	if (joinPrev && joinNext) {
+		prev->length += length + next->length;
+		removeRun(heap, i);
+	} else if (joinPrev) {
+		prev->length += length;
+	} else if (joinNext) {
+		next->start = start;
+		next->length += length;
+	} else if (heap->freeRunCount == heap->freeRunCapacity) {
+		heap->freeRunsValid = false;
+		heap->freeRunCount++;
+	} else {
+		insertRun(heap, i, start, length);
+	}
+}
+
+/*!
+ *  Makes sure the index can be used by the allocation strategies.
+ *
+ *  \return True if freeRuns holds all free runs of the map, false if the map
+ *          has to be scanned.
+ */
+bool os_memIndex_ready(Heap *heap) {
+	if (!heap->freeRunsValid && heap->freeRunCount <= heap->freeRunCapacity) {
+		rebuild(heap);
+	}
+	return heap->freeRunsValid;
+}
@@ -0,0 +1,30 @@
+/*
+ * os_memory_index.h
+ *
+ * Index of the free runs of a heap map, kept in internal SRAM so that the
+ * allocation strategies do not have to scan the whole map.
+ */
+
+
+#ifndef _OS_MEMORY_INDEX_H
+#define _OS_MEMORY_INDEX_H
+
+#include "os_memheap_drivers.h"
+
+#include <stdbool.h>
+
+
+//! Marks the whole use area of the heap as one free run
+void os_memIndex_reset(Heap *heap);
+
+//! Removes an allocated range (relative to the use area) from the index
+void os_memIndex_take(Heap *heap, uint16_t start, uint16_t length);
+
+//! Adds a freed range (relative to the use area) to the index
+void os_memIndex_release(Heap *heap, uint16_t start, uint16_t length);
+
+//! Rebuilds the index from the map if possible, returns whether it can be used
+bool os_memIndex_ready(Heap *heap);
+
+
+#endif
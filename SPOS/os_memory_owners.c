@@ -0,0 +1,106 @@
+/*
+ * os_memory_owners.c
+ *
+ * Every heap has a pool of OS_MEM_OWNED_CHUNKS entries that record the start
+ * of a chunk. The entries of each process are chained from ownedFirst, the
+ * unused ones from ownedUnused. os_malloc, os_realloc and os_free keep the
+ * chains up to date, so os_freeProcessMemory only visits the chunks of the
+ * process it cleans up instead of the whole map, however many of the
+ * entries that process holds.
+ *
+ * Only if the pool runs out, the chunk marks its owner in ownedOverflow. The
+ * garbage collection of such a process scans the map once as before and
+ * clears the mark again.
+ */
+
+#include "os_memory_owners.h"
+
+
+//! Ends a chain
+#define NO_ENTRY UINT8_MAX
+
+#if OS_MEM_OWNED_CHUNKS >= NO_ENTRY
+#error "Too many owned chunks for 8 bit links"
+#endif
+
+
+// ---------------------------------------------------
+//	Private Functions
+// ---------------------------------------------------
+
+//! Link to the entry of the chunk of pid starting at start, or to the end of the chain of pid
+static uint8_t* find(Heap *heap, ProcessID pid, uint16_t start) {
+	uint8_t *link = &heap->ownedFirst[pid];
+	while (*link != NO_ENTRY && heap->ownedChunks[*link].start != start) {
+		link = &heap->ownedChunks[*link].next;
+	}
+	return link;
+}
+
+
+// ---------------------------------------------------
+//	Public Functions
+// ---------------------------------------------------
+
+//! Chains all entries as unused, no process holds chunks in the heap afterwards
+void os_memOwners_reset(Heap *heap) {
+	for (uint8_t i = 0; i < OS_MEM_OWNED_CHUNKS; i++) {
+		heap->ownedChunks[i].next = (i + 1 < OS_MEM_OWNED_CHUNKS) ? i + 1 : NO_ENTRY;
+	}
+	heap->ownedUnused = 0;
+	for (uint8_t pid = 0; pid < MAX_NUMBER_OF_PROCESSES; pid++) {
+		heap->ownedFirst[pid] = NO_ENTRY;
+	}
+	heap->ownedOverflow = 0;
+}
+
+/*!
+ *  Records a chunk allocated for pid. If no entry is left, pid is marked so
+ *  its garbage collection falls back to scanning the map.
+ */
+void os_memOwners_add(Heap *heap, ProcessID pid, uint16_t start) {
+	uint8_t const i = heap->ownedUnused;
+	if (i == NO_ENTRY) {
+		heap->ownedOverflow |= 1 << pid;
+		return;
+	}
+	heap->ownedUnused = heap->ownedChunks[i].next;
+	heap->ownedChunks[i].start = start;
+	heap->ownedChunks[i].next = heap->ownedFirst[pid];
+	heap->ownedFirst[pid] = i;
+}
+
+//! Forgets a freed chunk, chunks that never made it into the table are ignored
+void os_memOwners_remove(Heap *heap, ProcessID pid, uint16_t start) {
+	uint8_t *link = find(heap, pid, start);
+	uint8_t const i = *link;
+	if (i != NO_ENTRY) {
+		*link = heap->ownedChunks[i].next;
+		heap->ownedChunks[i].next = heap->ownedUnused;
+		heap->ownedUnused = i;
+	}
+}
+
+//! Follows a chunk that os_realloc or the compaction moved
+void os_memOwners_move(Heap *heap, ProcessID pid, uint16_t from, uint16_t to) {
+	uint8_t const i = *find(heap, pid, from);
+	if (i != NO_ENTRY) {
+		heap->ownedChunks[i].start = to;
+	}
+}
+
+/*!
+ *  Removes one chunk of pid from the table, used by the garbage collection.
+ *
+ *  \param start Receives the start of the chunk (relative to the use area).
+ *  \return True if a chunk was found.
+ */
+bool os_memOwners_take(Heap *heap, ProcessID pid, uint16_t *start) {
+	uint8_t const i = heap->ownedFirst[pid];
+	if (i == NO_ENTRY) {
+		return false;
+	}
+	*start = heap->ownedChunks[i].start;
+	os_memOwners_remove(heap, pid, *start);
+	return true;
+}
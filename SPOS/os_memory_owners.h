@@ -0,0 +1,34 @@
+/*
+ * os_memory_owners.h
+ *
+ * Table of the chunks every process holds in a heap, kept in internal SRAM so
+ * that the garbage collection of a process does not have to scan the map.
+ */
+
+
+#ifndef _OS_MEMORY_OWNERS_H
+#define _OS_MEMORY_OWNERS_H
+
+#include "os_memheap_drivers.h"
+#include "os_process.h"
+
+#include <stdbool.h>
+
+
+//! Forgets all chunks of the heap
+void os_memOwners_reset(Heap *heap);
+
+//! Records a new chunk (relative to the use area) of pid
+void os_memOwners_add(Heap *heap, ProcessID pid, uint16_t start);
+
+//! Forgets the chunk of pid starting at start
+void os_memOwners_remove(Heap *heap, ProcessID pid, uint16_t start);
+
+//! Records that the chunk of pid starting at from now starts at to
+void os_memOwners_move(Heap *heap, ProcessID pid, uint16_t from, uint16_t to);
+
+//! Takes the next chunk of pid out of the table, returns false if there is none
+bool os_memOwners_take(Heap *heap, ProcessID pid, uint16_t *start);
+
+
+#endif
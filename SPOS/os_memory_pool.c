@@ -0,0 +1,108 @@
+/*
+ * os_memory_pool.c
+ *
+ * A pool starts with a PoolHeader, followed by its slots. Slots that were
+ * given back form a singly linked list through their first two bytes. Slots
+ * behind fresh were never handed out, so creating a pool does not have to
+ * link all of them first.
+ *
+ * Only the process that owns the pool chunk may use it. Freeing a slot twice
+ * is not detected and corrupts the free list, like freeing a chunk of the
+ * heap after it was handed out again.
+ */
+
+#include "os_memory_pool.h"
+#include "os_memory.h"
+#include "os_core.h"
+
+
+//! Bookkeeping at the start of every pool
+typedef struct {
+	uint16_t slotSize;
+	uint16_t count;
+	uint16_t fresh;		//!< Index of the first slot that was never handed out
+	MemAddr freeList;	//!< First slot that was given back, 0 if there is none
+} PoolHeader;
+
+
+// ---------------------------------------------------
+//	Private Functions
+// ---------------------------------------------------
+
+static void readHeader(Heap const *heap, MemAddr pool, PoolHeader *header) {
+	heap->driver->readBlock(pool, (MemValue*)header, sizeof(*header));
+}
+
+static void writeHeader(Heap const *heap, MemAddr pool, PoolHeader const *header) {
+	heap->driver->writeBlock(pool, (MemValue const*)header, sizeof(*header));
+}
+
+
+// ---------------------------------------------------
+//	Public Functions
+// ---------------------------------------------------
+
+/*!
+ *  Allocates the pool as one chunk of the current process.
+ *
+ *  \param objSize Size of each slot, at least the two bytes that link free slots are used.
+ *  \param count Number of slots, must not be 0.
+ *  \return The address of the pool, which identifies it in the other calls, or 0.
+ */
+MemAddr os_poolCreate(Heap *heap, uint16_t objSize, uint16_t count) {
+	PoolHeader header = {(objSize < sizeof(MemAddr)) ? sizeof(MemAddr) : objSize, count, 0, 0};
+	uint32_t const size = sizeof(header) + (uint32_t)header.slotSize * count;
+	if (count == 0 || size > heap->sizeUse) {
+		return 0;
+	}
+
+	os_enterCriticalSection();
+	MemAddr const pool = os_malloc(heap, size);
+	if (pool != 0) {
+		writeHeader(heap, pool, &header);
+	}
+	os_leaveCriticalSection();
+	return pool;
+}
+
+//! Pops the free list or, if it is empty, hands out the next fresh slot
+MemAddr os_poolAlloc(Heap *heap, MemAddr pool) {
+	MemAddr slot = 0;
+
+	os_enterCriticalSection();
+	if (os_isChunkStart(heap, pool, os_getCurrentProc())) {
+		PoolHeader header;
+		readHeader(heap, pool, &header);
+		if (header.freeList != 0) {
+			slot = header.freeList;
+			heap->driver->readBlock(slot, (MemValue*)&header.freeList, sizeof(header.freeList));
+			writeHeader(heap, pool, &header);
+		} else if (header.fresh < header.count) {
+			slot = pool + sizeof(header) + header.fresh * header.slotSize;
+			header.fresh++;
+			writeHeader(heap, pool, &header);
+		}
+	}
+	os_leaveCriticalSection();
+	return slot;
+}
+
+//! Pushes the slot onto the free list, addresses that are no slot of the pool are ignored
+void os_poolFree(Heap *heap, MemAddr pool, MemAddr slot) {
+	os_enterCriticalSection();
+	if (os_isChunkStart(heap, pool, os_getCurrentProc()) && slot >= pool + sizeof(PoolHeader)) {
+		PoolHeader header;
+		readHeader(heap, pool, &header);
+		uint16_t const offset = slot - pool - sizeof(header);
+		if (offset % header.slotSize == 0 && offset / header.slotSize < header.fresh) {
+			heap->driver->writeBlock(slot, (MemValue const*)&header.freeList, sizeof(header.freeList));
+			header.freeList = slot;
+			writeHeader(heap, pool, &header);
+		}
+	}
+	os_leaveCriticalSection();
+}
+
+void os_poolDestroy(Heap *heap, MemAddr pool) {
+	os_free(heap, pool);
+}
@@ -0,0 +1,29 @@
+/*
+ * os_memory_pool.h
+ *
+ * Pools of fixed-size slots. A pool is a single os_malloc chunk of the
+ * process that creates it, so it is released by os_kill like any other
+ * chunk, while its slots are handed out and taken back in constant time.
+ */
+
+
+#ifndef _OS_MEMORY_POOL_H
+#define _OS_MEMORY_POOL_H
+
+#include "os_memheap_drivers.h"
+
+
+//! Creates a pool of count slots of objSize bytes for the current process, returns 0 if there is no space
+MemAddr os_poolCreate(Heap *heap, uint16_t objSize, uint16_t count);
+
+//! Takes a slot out of the pool, returns 0 if all slots are in use
+MemAddr os_poolAlloc(Heap *heap, MemAddr pool);
+
+//! Gives a slot back to the pool
+void os_poolFree(Heap *heap, MemAddr pool, MemAddr slot);
+
+//! Releases the pool together with all of its slots
+void os_poolDestroy(Heap *heap, MemAddr pool);
+
+
+#endif
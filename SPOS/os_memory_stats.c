@@ -0,0 +1,170 @@
+/*
+ * os_memory_stats.c
+ *
+ * Bookkeeping behind os_memory_stats.h. The hooks are called inside the
+ * critical sections of the allocator, so they only do a few additions.
+ * Counters saturate instead of wrapping around.
+ */
+
+#include "os_memory_stats.h"
+#include "os_memory.h"
+#include "os_memory_index.h"
+
+
+// ---------------------------------------------------
+//	Fragmentation
+// ---------------------------------------------------
+
+/*!
+ *  Collects the free runs of the heap. The free run index is used if it holds
+ *  all of them, otherwise the map is scanned run by run.
+ *
+ *  \param heap The heap to look at.
+ *  \param frag Receives the free bytes, the largest free run and the number of runs.
+ */
+void os_memStats_fragmentation(Heap *heap, HeapFragmentation *frag) {
+	os_enterCriticalSection();
+	frag->freeBytes = 0;
+	frag->largestRun = 0;
+	frag->runs = 0;
+
+	if (os_memIndex_ready(heap)) {
+		for (uint8_t i = 0; i < heap->freeRunCount; i++) {
+			uint16_t const length = heap->freeRuns[i].length;
+			frag->freeBytes += length;
+			if (length > frag->largestRun) {
+				frag->largestRun = length;
+			}
+		}
+		frag->runs = heap->freeRunCount;
+	} else {
+		uint16_t start = os_mapSkipUsed(heap, 0, heap->blockCount);
+		while (start < heap->blockCount) {
+			uint16_t const end = os_mapSkipEqual(heap, start, heap->blockCount, 0);
+			frag->freeBytes += end - start;
+			if (end - start > frag->largestRun) {
+				frag->largestRun = end - start;
+			}
+			frag->runs++;
+			start = os_mapSkipUsed(heap, end, heap->blockCount);
+		}
+	}
+	// Runs are counted in blocks
+	frag->freeBytes <<= heap->blockShift;
+	frag->largestRun <<= heap->blockShift;
+	os_leaveCriticalSection();
+}
+
+/*!
+ *  External fragmentation of the free space: 0 if all free bytes form one
+ *  run (or there are none), close to 100 if the largest run is only a tiny
+ *  part of them.
+ *
+ *  \param frag Result of os_memStats_fragmentation.
+ *  \return 100 * (1 - largest run / free bytes), rounded down.
+ */
+uint8_t os_memStats_externalFragmentation(HeapFragmentation const *frag) {
+	if (frag->freeBytes == 0) {
+		return 0;
+	}
+	return 100 - (uint8_t)(((uint32_t)frag->largestRun * 100 + frag->freeBytes - 1) / frag->freeBytes);
+}
+
+
+#if OS_MEM_STATS
+
+// ---------------------------------------------------
+//	Counters
+// ---------------------------------------------------
+
+//! Adds one to a counter unless it is saturated
+static void increment(uint16_t *counter) {
+	if (*counter != UINT16_MAX) {
+		(*counter)++;
+	}
+}
+
+//! Adds to a counter unless it would overflow, in which case it saturates
+static void add(uint32_t *counter, uint32_t value) {
+	*counter = (*counter > UINT32_MAX - value) ? UINT32_MAX : *counter + value;
+}
+
+/*!
+ *  Clears all counters of the heap. The bytes held by the processes are kept,
+ *  they describe the current state and not the history.
+ */
+void os_memStats_reset(Heap *heap) {
+	os_enterCriticalSection();
+	for (ProcessID pid = 0; pid < MAX_NUMBER_OF_PROCESSES; pid++) {
+		heap->allocStats[pid].allocs = 0;
+		heap->allocStats[pid].frees = 0;
+		heap->allocStats[pid].failures = 0;
+	}
+	heap->bytesRequested = 0;
+	heap->strategyTime = 0;
+	os_leaveCriticalSection();
+}
+
+//! Counters of a process slot on the heap
+AllocStats const* os_memStats_process(Heap const *heap, ProcessID pid) {
+	return &heap->allocStats[pid];
+}
+
+/*!
+ *  Adds up the counters of all process slots (saturating).
+ *
+ *  \param heap The heap to look at.
+ *  \param total Receives the sums.
+ */
+void os_memStats_total(Heap const *heap, AllocStats *total) {
+	uint32_t sums[4] = {0, 0, 0, 0};
+	for (ProcessID pid = 0; pid < MAX_NUMBER_OF_PROCESSES; pid++) {
+		AllocStats const *stats = &heap->allocStats[pid];
+		sums[0] += stats->allocs;
+		sums[1] += stats->frees;
+		sums[2] += stats->failures;
+		sums[3] += stats->liveBytes;
+	}
+	total->allocs = (sums[0] > UINT16_MAX) ? UINT16_MAX : sums[0];
+	total->frees = (sums[1] > UINT16_MAX) ? UINT16_MAX : sums[1];
+	total->failures = (sums[2] > UINT16_MAX) ? UINT16_MAX : sums[2];
+	total->liveBytes = (sums[3] > UINT16_MAX) ? UINT16_MAX : sums[3];
+}
+
+/*!
+ *  Counts an os_malloc or os_realloc call.
+ *
+ *  \param heap The heap the call went to.
+ *  \param pid The calling process.
+ *  \param size The requested size, the chunk holds it rounded up by os_chunkBlocks.
+ *  \param oldSize The size of the chunk that was reallocated, 0 for os_malloc.
+ *  \param addr The result of the call, 0 if it failed.
+ */
+void os_memStats_alloc(Heap *heap, ProcessID pid, uint16_t size, uint16_t oldSize, MemAddr addr) {
+	AllocStats *stats = &heap->allocStats[pid];
+	increment(&stats->allocs);
+	if (addr == 0) {
+		increment(&stats->failures);
+	} else {
+		add(&heap->bytesRequested, size);
+		stats->liveBytes += (os_chunkBlocks(heap, size) << heap->blockShift) - oldSize;
+	}
+}
+
+//! Counts an os_free call that released a chunk of size bytes
+void os_memStats_free(Heap *heap, ProcessID pid, uint16_t size) {
+	increment(&heap->allocStats[pid].frees);
+	heap->allocStats[pid].liveBytes -= size;
+}
+
+//! The garbage collection released everything pid held
+void os_memStats_releaseAll(Heap *heap, ProcessID pid) {
+	heap->allocStats[pid].liveBytes = 0;
+}
+
+//! Adds the time since start to the time spent in the allocation strategies
+void os_memStats_strategy(Heap *heap, Time start) {
+	add(&heap->strategyTime, os_systemTime_ticks() - start);
+}
+
+#endif
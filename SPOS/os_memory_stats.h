@@ -0,0 +1,67 @@
+/*
+ * os_memory_stats.h
+ *
+ * Allocation profiler of the heaps. os_malloc, os_realloc and os_free report
+ * every call here, counted per heap and process slot. The fragmentation of a
+ * heap is not tracked but computed on demand from its map. The counters are
+ * only compiled if OS_MEM_STATS is set, otherwise the hooks expand to nothing.
+ */
+
+
+#ifndef _OS_MEMORY_STATS_H
+#define _OS_MEMORY_STATS_H
+
+#include "os_memheap_drivers.h"
+#include "os_scheduler.h"
+#include "util.h"
+
+#include <stdint.h>
+
+
+//! Free space of a heap as seen in its map
+typedef struct {
+	uint16_t freeBytes;	//!< Free bytes in the use area
+	uint16_t largestRun;	//!< Length of the largest free run
+	uint16_t runs;		//!< Number of free runs
+} HeapFragmentation;
+
+//! Scans the heap for its free runs
+void os_memStats_fragmentation(Heap *heap, HeapFragmentation *frag);
+
+//! External fragmentation in percent: the share of free bytes outside the largest free run
+uint8_t os_memStats_externalFragmentation(HeapFragmentation const *frag);
+
+#if OS_MEM_STATS
+
+//! Clears all counters of the heap
+void os_memStats_reset(Heap *heap);
+
+//! Counters of a process slot on the heap
+AllocStats const* os_memStats_process(Heap const *heap, ProcessID pid);
+
+//! Counters of all process slots on the heap added up
+void os_memStats_total(Heap const *heap, AllocStats *total);
+
+//! Hook: pid asked for size bytes in place of a chunk of oldSize bytes (0 for os_malloc) and got addr
+void os_memStats_alloc(Heap *heap, ProcessID pid, uint16_t size, uint16_t oldSize, MemAddr addr);
+
+//! Hook: pid freed a chunk of size bytes
+void os_memStats_free(Heap *heap, ProcessID pid, uint16_t size);
+
+//! Hook: all memory of pid was released by the garbage collection
+void os_memStats_releaseAll(Heap *heap, ProcessID pid);
+
+//! Hook: an allocation strategy that was started at the given time returned
+void os_memStats_strategy(Heap *heap, Time start);
+
+#else
+
+#define os_memStats_alloc(heap, pid, size, oldSize, addr) ((void)0)
+#define os_memStats_free(heap, pid, size) ((void)0)
+#define os_memStats_releaseAll(heap, pid) ((void)0)
+#define os_memStats_strategy(heap, start) ((void)0)
+
+#endif
+
+
+#endif
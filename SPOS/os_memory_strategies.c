@@ -9,130 +9,136 @@
 #include "os_memory_strategies.h"
 #include "defines.h"
 #include "os_memory.h"
+#include "os_memory_index.h"
+#include "os_memory_buddy.h"
 
 
-MemAddr fitFromAddr(Heap* heap, uint16_t size, uint16_t startAddr){
-	uint16_t allocAddr = startAddr;
+// ---------------------------------------------------
+//	Strategies on the free run index
+// ---------------------------------------------------
+
+//! First free run of at least size blocks that ends behind startAddr and starts before limit, 0 if there is none
+static MemAddr indexFitFromAddr(Heap const* heap, uint16_t size, uint16_t startAddr, uint16_t limit){
+	for(uint8_t i = 0; i < heap->freeRunCount && heap->freeRuns[i].start < limit; i++){
+		FreeRun const* run = &heap->freeRuns[i];
+		uint16_t start = (run->start > startAddr) ? run->start : startAddr;
+		uint16_t end = run->start + run->length;
+		
+		if(end > start && end - start >= size){
+			return os_blockToAddr(heap, start);
+		}
+	}
+	return 0;
+}
+
+//! Smallest (best) or largest (worst) free run of at least size blocks, 0 if there is none
+static MemAddr indexFitBySize(Heap const* heap, uint16_t size, bool best){
+	FreeRun const* found = NULL;
 	
-	while(allocAddr < heap->sizeMap*2) {
-		uint8_t nibVal = getNibbleVal(heap, allocAddr);
+	for(uint8_t i = 0; i < heap->freeRunCount; i++){
+		FreeRun const* run = &heap->freeRuns[i];
+		if(run->length < size){
+			continue;
+		}
+		if(found == NULL || (best ? (run->length < found->length) : (run->length > found->length))){
+			found = run;
+		}
+	}
+	return found ? os_blockToAddr(heap, found->start) : 0;
+}
+
+
+// ---------------------------------------------------
+//	Strategies on the map (if the index overflowed)
+// ---------------------------------------------------
+
+//! First free run of at least size blocks from startAddr on that starts before limit, 0 if there is none
+static MemAddr fitFromAddr(Heap const* heap, uint16_t size, uint16_t startAddr, uint16_t limit){
+	uint16_t start = os_mapSkipUsed(heap, startAddr, limit);
+	
+	while(start < limit){
+		uint16_t end = os_mapSkipEqual(heap, start, heap->blockCount, 0);
 		
-		// A free nibble found
-		if(nibVal == 0){
-			
-			// Set the beginning of the block
-			uint16_t start = allocAddr;
-			
-			// Allocate the space size-times
-			while((allocAddr < heap->sizeMap*2) && (allocAddr - start < size)){
-				// Move to the next address
-				allocAddr++;
-				
-				// Stop if the nibble at the allocAddr is not free
-				if(getNibbleVal(heap, allocAddr) != 0){
-					break;
-				}
-			}
-			
-			// Check if enough space was allocated
-			if(allocAddr - start >= size){
-				//return getAddrForNibble(heap, start);
-				return heap->firstUseAddr + start;
-			}	
-			} else {
-			allocAddr++;
+		if(end - start >= size){
+			return os_blockToAddr(heap, start);
 		}
+		start = os_mapSkipUsed(heap, end, limit);
 	}
 	return 0;
 }
 
+//! Smallest (best) or largest (worst) free run of at least size blocks, 0 if there is none
+static MemAddr mapFitBySize(Heap const* heap, uint16_t size, bool best){
+	uint16_t foundStart = 0;
+	uint16_t foundLength = 0;
+	uint16_t start = os_mapSkipUsed(heap, 0, heap->blockCount);
+	
+	while(start < heap->blockCount){
+		uint16_t end = os_mapSkipEqual(heap, start, heap->blockCount, 0);
+		uint16_t length = end - start;
+		
+		if(length >= size && (foundLength == 0 || (best ? (length < foundLength) : (length > foundLength)))){
+			foundStart = start;
+			foundLength = length;
+		}
+		start = os_mapSkipUsed(heap, end, heap->blockCount);
+	}
+	return foundLength ? os_blockToAddr(heap, foundStart) : 0;
+}
+
+
+// ---------------------------------------------------
+//	Allocation strategies (size in blocks)
+// ---------------------------------------------------
 
 MemAddr os_MemAlloc_FirstFit(Heap* heap, uint16_t size){
-	return fitFromAddr(heap, size, 0);
+	if(os_memIndex_ready(heap)){
+		return indexFitFromAddr(heap, size, 0, heap->blockCount);
+	}
+	return fitFromAddr(heap, size, 0, heap->blockCount);
 }
 
 
+/*!
+ *  One circular scan that starts at the rover: first from the rover to the
+ *  end of the heap, then from the start of the heap up to the run that holds
+ *  the rover (which is looked at as a whole again). The rover moves behind
+ *  the new chunk, so the next search continues where this one stopped.
+ */
 MemAddr os_MemAlloc_NextFit(Heap* heap, uint16_t size){
-	MemAddr lastCached = heap->nextFitAddrLast;
+	uint16_t const rover = heap->nextFitBlock;
+	bool const indexed = os_memIndex_ready(heap);
 	
-	MemAddr addr = fitFromAddr(heap, size, lastCached);
+	MemAddr addr = indexed ? indexFitFromAddr(heap, size, rover, heap->blockCount) : fitFromAddr(heap, size, rover, heap->blockCount);
 	
-	if(addr == 0){
-		addr = fitFromAddr(heap, size, 0);
+	if(addr == 0 && rover != 0){
+		addr = indexed ? indexFitFromAddr(heap, size, 0, rover) : fitFromAddr(heap, size, 0, rover);
 	}
 	if(addr != 0){
-		heap->nextFitAddrLast = (addr - heap->firstUseAddr);
+		uint16_t const end = os_addrToBlock(heap, addr) + size;
+		heap->nextFitBlock = (end < heap->blockCount) ? end : 0;
 	}
 	return addr;
 }
 
 
 MemAddr os_MemAlloc_BestFit(Heap* heap, uint16_t size){
-	MemAddr currFound = 0;
-	MemAddr minFound = 0;
-	uint16_t minSize = 0xffff;
-	
-	for(MemAddr addr_i = 0; (addr_i < heap->sizeUse); addr_i++){
-		currFound = addr_i;
-		MemAddr temp;
-		
-		if((temp = getNibble(heap, addr_i)) == 0){
-			do{
-				addr_i++;
-			} while ((temp = getNibble(heap, addr_i)) == 0 && addr_i < heap->sizeUse);
-			
-			uint16_t length = addr_i - currFound;
-			
-			if(length >= size && length < minSize){
-				minSize = length;
-				minFound = currFound;
-			}
-			addr_i--;
-		}
+	if(os_memIndex_ready(heap)){
+		return indexFitBySize(heap, size, true);
 	}
-	
-	if(minSize != 0xffff){
-		return heap->firstUseAddr + minFound;
-	}
-	return 0;
+	return mapFitBySize(heap, size, true);
 }
 
 
 MemAddr os_MemAlloc_WorstFit(Heap* heap, uint16_t size){
-	MemAddr	foundAdr = 0;
-	MemAddr	foundNewAdr	= 0;
-	size_t curLargestSize = 0;
-	size_t newSize = 0;
-	MemValue nibbles = 0;
-	
-	
-	if (size == 0 || size > heap->sizeUse) {
-		return foundAdr;
-	}
-	
-	for(MemAddr iAddr =  0; iAddr < heap->sizeMap; iAddr++) {
-		nibbles = os_getMapEntry(heap, heap->firstMapAddr+iAddr);
-		for (int i = 0; i <= 1; i++) {
-			MemValue nibble = (nibbles&(0xf0>>(i*4))) >> ((1-i)*4);
-			if (nibble == 0) {
-				if (foundNewAdr == 0) {
-					foundNewAdr = heap->firstUseAddr + iAddr*2+(i);
-				}
-				newSize++;
-				} else if(newSize > curLargestSize && newSize >= size) {
-				foundAdr = foundNewAdr;
-				curLargestSize = newSize;
-				foundNewAdr = 0;
-				newSize = 0;
-				} else {
-				foundNewAdr = 0;
-				newSize = 0;
-			}
-		}
+	if(os_memIndex_ready(heap)){
+		return indexFitBySize(heap, size, false);
 	}
-	
-	if(newSize > curLargestSize && newSize >= size) {
-		foundAdr = foundNewAdr;
-	}
-	return foundAdr;
+	return mapFitBySize(heap, size, false);
 }
+
+
+MemAddr os_MemAlloc_Buddy(Heap* heap, uint16_t size){
+	uint16_t const block = os_memBuddy_alloc(heap, size);
+	return (block != OS_MEM_BUDDY_NONE) ? os_blockToAddr(heap, block) : 0;
+}
\ No newline at end of file
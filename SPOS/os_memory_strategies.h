@@ -29,6 +29,9 @@ MemAddr os_MemAlloc_BestFit(Heap* heap, uint16_t size);
 //! Worst Fit strategy
 MemAddr os_MemAlloc_WorstFit(Heap* heap, uint16_t size);
 
+//! Buddy strategy, size must be a result of os_memBuddy_blocks
+MemAddr os_MemAlloc_Buddy(Heap* heap, uint16_t size);
+
 
 
 
@@ -51,20 +51,18 @@ typedef union StackPointer {
  *  The struct that holds all information for a process.
  *  Note that additional scheduling information (such as the current time-slice)
  *  are stored by the module that implements the actual scheduling strategies.
+ *  The fields the scheduler touches at every switch come first. What the
+ *  allocator needs per process lives in the heaps (see Heap).
  */
 //#warning IMPLEMENT STH. HERE
 typedef struct {
-    Program* program;
 	enum ProcessState state;
 	Priority priority;
 	union StackPointer sp;
 	StackChecksum checksum;
 	
-	// For optimized garbage collection
-	MemAddr allocFrameStartInt;
-	MemAddr allocFrameEndInt;
-	MemAddr allocFrameStartExt;
-	MemAddr allocFrameEndExt;
+	// Only read when the process is started or shown
+	Program* program;
 } Process;
 
 /*!
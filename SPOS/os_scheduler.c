@@ -17,8 +17,13 @@
 #include "os_core.h"
 #include "lcd.h"
 #include "os_memory.h"
+#include "os_memory_handles.h"
+#include "os_stats.h"
+#include "os_sync.h"
+#include "os_spi.h"
 
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
 #include <stdbool.h>
 #include <util/delay.h>
 
@@ -42,6 +47,18 @@ Process os_processes[MAX_NUMBER_OF_PROCESSES];
 
 ProcessID currentProc;
 
+//! Bit i is set while process i is ready or running
+uint8_t os_readyMask;
+
+//! Bit i is set while process i is blocked in os_sleep
+static uint8_t os_sleepMask;
+
+//! Timer 0 overflow count (lower 16 bits) at which each sleeping process is woken up
+static uint16_t os_wakeupTime[MAX_NUMBER_OF_PROCESSES];
+
+//! Timer 0 overflows until the next sleeper wakes up, set by os_wakeSleepers (the naked ISR cannot keep locals)
+static uint16_t os_sleepTime;
+
 //----------------------------------------------------------------------------
 // Private variables
 //----------------------------------------------------------------------------
@@ -65,6 +82,21 @@ ISR(TIMER2_COMPA_vect) __attribute__((naked));
 
 void os_dispatcher(void);
 
+//! Prepares the integrity check of a freshly set up stack
+static void os_initStackCheck(ProcessID pid);
+
+//! Records or checks the stack of a process that was just preempted
+static void os_leaveStack(ProcessID pid);
+
+//! Checks the stack of a process before it is resumed
+static void os_enterStack(ProcessID pid);
+
+//! Sets the compare value of Timer 2 for the coming time slice
+static void os_setTimeSlice(uint8_t compare);
+
+//! Wakes up the sleeping processes whose time has come
+static void os_wakeSleepers(void);
+
 //----------------------------------------------------------------------------
 // Function definitions
 //----------------------------------------------------------------------------
@@ -88,19 +120,25 @@ ISR(TIMER2_COMPA_vect) {
 	
 	// set the stack pointer to scheduler stack
 	SP = BOTTOM_OF_ISR_STACK;
-	os_processes[currentProc].checksum = os_getStackChecksum(currentProc);
+	os_stats_leave(currentProc);
+	os_leaveStack(currentProc);
 	
 	// If esc and enter pressed
 	if(os_getInput() == 0b00001001){
 		os_waitForNoInput();
 		os_taskManMain();
+		os_stats_skipTaskMan();
 	}
 	
-	// set the state of the current process to RUNNING
-	if ( os_processes[os_getCurrentProc()].state != OS_PS_UNUSED ) {
+	// set the state of the current process to READY (both are runnable, so os_readyMask stays as it is)
+	// unless it was killed or blocked itself
+	if ( os_processes[os_getCurrentProc()].state == OS_PS_RUNNING ) {
 		os_processes[os_getCurrentProc()].state = OS_PS_READY;
+		os_stats_ready(os_getCurrentProc());
 		}
 	
+	os_wakeSleepers();
+	
 	// Select the next process based on the current scheduling strategy
 	switch(os_getSchedulingStrategy()){
 		case OS_SS_EVEN:
@@ -124,12 +162,21 @@ ISR(TIMER2_COMPA_vect) {
 			break;
 	}
 	
-	if(os_processes[currentProc].checksum != os_getStackChecksum(currentProc)){
-		os_error("The stack is inconsistent");
+	os_enterStack(currentProc);
+	
+	// If nothing but idle is runnable, there is no need to preempt it before the next process wakes up
+	// (one Timer 0 overflow lasts 64 Timer 2 counts)
+	if(os_readyMask & ~1){
+		os_setTimeSlice(SCHEDULER_PERIOD);
+	} else if(os_sleepTime < (SCHEDULER_IDLE_PERIOD + 1) / 64){
+		os_setTimeSlice(os_sleepTime * 64 - 1);
+	} else {
+		os_setTimeSlice(SCHEDULER_IDLE_PERIOD);
 	}
 	
 	// set the state of the new current process to RUNNING
 	os_processes[currentProc].state = OS_PS_RUNNING;
+	os_stats_enter(currentProc);
 	
 	// set the stack pointer to the stack of the next process
 	SP = os_processes[currentProc].sp.as_int;
@@ -140,16 +187,28 @@ ISR(TIMER2_COMPA_vect) {
 
 /*!
  *  This is the idle program. The idle process owns all the memory
- *  and processor time no other process wants to have.
+ *  and processor time no other process wants to have. It spends that time
+ *  compacting the heaps first (see os_memory_handles.h).
  */
 void idle(void) {
    // #warning IMPLEMENT STH. HERE
+#if OS_TICKLESS_IDLE
+	// sleep until the next interrupt, the timers keep running in idle sleep mode
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	while(1){
+		if(!os_memCompact(intHeap) && !os_memCompact(extHeap)){
+			sleep_mode();
+		}
+	}
+#else
    // infinite output of "." on the LCD
     while(1){
+	    while(os_memCompact(intHeap) || os_memCompact(extHeap));
 	    lcd_writeChar('.');
 		// wait as many millisecs as the define default_output_delay says
 	    _delay_ms(DEFAULT_OUTPUT_DELAY);
     }
+#endif
 }
 
 /*!
@@ -189,37 +248,24 @@ ProcessID os_exec(Program *program, Priority priority) {
 		return INVALID_PROCESS;
 	}
 	
-	Process prog;
+	// The slot is filled in place, it cannot be picked before the critical section ends
+	Process* process = &os_processes[pid];
+	process->program = program;
+	process->priority = priority;
 	
-	/* For efficient garbage collection, we use the MapAdress*/
-	prog.allocFrameStartInt = 0x0471; // intHeap__.startMapAddr + intHeap__.sizeMap - 1;
-	prog.allocFrameEndInt = 0x022c; // intHeap__.startMapAddr;
-	prog.allocFrameStartExt = 0xffff; // extHeap__.startMapAddr + extHeap__.sizeMap - 1;
-	prog.allocFrameEndExt = 0x0000; // extHeap__.startMapAddr;
-	
-	prog.program = program;
-	prog.priority = priority;
-	prog.state = OS_PS_READY;
-	prog.sp.as_int = PROCESS_STACK_BOTTOM(pid);
-	
-	prog.sp.as_ptr[0] = (uint8_t)(((uint16_t)(&os_dispatcher))&0x00FF);
-	prog.sp.as_ptr[-1] = (uint8_t)(((uint16_t)(&os_dispatcher))>>8);
-	
-
-	for(int i = 0; i < 33; i++) {
-		prog.sp.as_ptr[-2-i] = 0;
-		prog.sp.as_int--;
-	}
-	prog.sp.as_int-=2;
-	os_processes[pid] = prog;
-	os_processes[pid].checksum = os_getStackChecksum(pid);
-	
-	for(uint8_t i = 0; i < 2; i++){
-		Heap* heap = os_lookupHeap(i);
-		heap->firstNibble[pid] = heap->sizeMap;
-		heap->lastNibble[pid] = 0;
+	// Initial stack: the return address os_dispatcher and 33 zeroed registers for restoreContext
+	uint8_t* stack = (uint8_t*)PROCESS_STACK_BOTTOM(pid);
+	stack[0] = (uint8_t)(((uint16_t)(&os_dispatcher))&0x00FF);
+	stack[-1] = (uint8_t)(((uint16_t)(&os_dispatcher))>>8);
+	for(uint8_t i = 0; i < 33; i++) {
+		stack[-2-i] = 0;
 	}
-	
+	process->sp.as_int = PROCESS_STACK_BOTTOM(pid) - 35;
+	process->state = OS_PS_READY;
+	os_initStackCheck(pid);
+	os_readyMask |= (1 << pid);
+	os_stats_initProcess(pid);
+	os_stats_ready(pid);
 	
 	os_resetProcessSchedulingInformation(pid);
 	
@@ -257,6 +303,7 @@ void os_initScheduler(void) {
 	for(uint8_t i = 0; i<MAX_NUMBER_OF_PROCESSES; i++){
 		os_processes[i].state = OS_PS_UNUSED;
 	}
+	os_readyMask = 0;
 	
 	os_exec(idle, DEFAULT_PRIORITY);
 	
@@ -327,9 +374,10 @@ void os_enterCriticalSection(void) {
   // sets GIEB to 0 / deactivates the GIEB, therefore global interrupts will be deactivated
   SREG &= 0b011111111;
   //increment variable criticalSectionCount which is following the nesting depth
-  criticalSectionCount++;
-  //deactivate scheduler through changing a bit in the register TIMSK2
-  TIMSK2 &= 0b11111101;
+  //deactivate scheduler through changing a bit in the register TIMSK2, nested sections find it deactivated already
+  if (criticalSectionCount++ == 0){
+	  TIMSK2 &= 0b11111101;
+  }
   //restore the previous saved state of the GIEB in SREG
   SREG |= a;
 }
@@ -389,6 +437,226 @@ StackChecksum os_getStackChecksum(ProcessID pid) {
    return tmp;
 }
 
+/*!
+ *  Called by the scheduler to make every sleeping process ready whose wake-up
+ *  time has passed. Leaves the number of Timer 0 overflows until the next of
+ *  the remaining sleepers wakes up (at least 1, 0xFFFF if nobody sleeps) in
+ *  os_sleepTime.
+ */
+static void os_wakeSleepers(void) {
+	uint16_t next = 0xFFFF;
+	if(!os_sleepMask){
+		os_sleepTime = next;
+		return;
+	}
+	
+	uint16_t now = (uint16_t)os_systemTime_overflowCount();
+	for(ProcessID pid = 1; pid < MAX_NUMBER_OF_PROCESSES; pid++){
+		if(os_sleepMask & (1 << pid)){
+			int16_t remaining = (int16_t)(os_wakeupTime[pid] - now);
+			if(remaining <= 0){
+				os_unblock(pid);
+			} else if((uint16_t)remaining < next){
+				next = remaining;
+			}
+		}
+	}
+	os_sleepTime = next;
+}
+
+/*!
+ *  Sets the length of the coming time slice. Lowering OCR2A below the
+ *  current count would let Timer 2 run through a full cycle first, so the
+ *  count is restarted whenever the length changes. Without tickless idle
+ *  every slice has the regular length, which also undoes os_preempt.
+ *
+ *  \param compare The compare value (SCHEDULER_PERIOD or SCHEDULER_IDLE_PERIOD).
+ */
+static void os_setTimeSlice(uint8_t compare) {
+#if !OS_TICKLESS_IDLE
+	compare = SCHEDULER_PERIOD;
+#endif
+	if(OCR2A != compare){
+		OCR2A = compare;
+		TCNT2 = 0;
+	}
+}
+
+#if OS_STACK_CHECK == OS_STACK_CHECK_CANARY
+/*!
+ *  Checks the guard bytes at the far end of the stack of a process. They lie
+ *  right above the bottom of the next stack, so a process that grows its
+ *  stack beyond STACK_SIZE_PROC overwrites them before anything else.
+ *
+ *  \param pid The ID of the process.
+ *  \return True if all guard bytes are untouched.
+ */
+static bool os_isStackCanaryIntact(ProcessID pid) {
+	uint8_t const* canary = (uint8_t const*)(PROCESS_STACK_BOTTOM(pid + 1) + 1);
+	for(uint8_t i = 0; i < STACK_CANARY_SIZE; i++){
+		if(canary[i] != STACK_CANARY_VALUE){
+			return false;
+		}
+	}
+	return true;
+}
+#endif
+
+/*!
+ *  Writes the guard bytes or computes the first checksum of a new stack,
+ *  depending on OS_STACK_CHECK.
+ *
+ *  \param pid The ID of the process whose stack was set up.
+ */
+static void os_initStackCheck(ProcessID pid) {
+#if OS_STACK_CHECK == OS_STACK_CHECK_CANARY
+	uint8_t* canary = (uint8_t*)(PROCESS_STACK_BOTTOM(pid + 1) + 1);
+	for(uint8_t i = 0; i < STACK_CANARY_SIZE; i++){
+		canary[i] = STACK_CANARY_VALUE;
+	}
+#elif OS_STACK_CHECK == OS_STACK_CHECK_CHECKSUM
+	os_processes[pid].checksum = os_getStackChecksum(pid);
+#endif
+}
+
+/*!
+ *  Called by the scheduler after the context of a process was saved. A
+ *  process that overflowed its stack is caught right here, before another
+ *  process runs on the damaged neighbouring stack.
+ *
+ *  \param pid The ID of the preempted process.
+ */
+static void os_leaveStack(ProcessID pid) {
+#if OS_STACK_CHECK == OS_STACK_CHECK_CANARY
+	if(!os_isStackCanaryIntact(pid)){
+		os_error("Stack overflow");
+	}
+#elif OS_STACK_CHECK == OS_STACK_CHECK_CHECKSUM
+	os_processes[pid].checksum = os_getStackChecksum(pid);
+#endif
+}
+
+/*!
+ *  Called by the scheduler before the context of a process is restored.
+ *
+ *  \param pid The ID of the process to be resumed.
+ */
+static void os_enterStack(ProcessID pid) {
+#if OS_STACK_CHECK == OS_STACK_CHECK_CANARY
+	if(!os_isStackCanaryIntact(pid)){
+		os_error("Stack overflow");
+	}
+#elif OS_STACK_CHECK == OS_STACK_CHECK_CHECKSUM
+	if(os_processes[pid].checksum != os_getStackChecksum(pid)){
+		os_error("The stack is inconsistent");
+	}
+#endif
+}
+
+/*!
+ *  Gives up the rest of the time slice by entering the scheduler ISR directly,
+ *  as if Timer 2 had fired. This also works inside critical sections: their
+ *  nesting depth is kept aside until the process is resumed, so the processes
+ *  in between run with the scheduler enabled.
+ */
+void os_yield(void) {
+	uint8_t sreg = SREG;
+	cli();
+	uint8_t nesting = criticalSectionCount;
+	criticalSectionCount = 0;
+	sbi(TIMSK2, OCIE2A);
+	
+	// The ISR saves the context like for an interrupt and resumes here with reti
+	TIMER2_COMPA_vect();
+	
+	cli();
+	criticalSectionCount = nesting;
+	if(nesting){
+		cbi(TIMSK2, OCIE2A);
+	}
+	SREG = sreg;
+}
+
+/*!
+ *  Blocks the current process. The scheduler skips it until some other
+ *  process or the scheduler itself calls os_unblock for it. Callers must
+ *  expect to be woken up early (e.g. after the slot was reused) and check
+ *  their condition again.
+ */
+void os_block(void) {
+	os_enterCriticalSection();
+	os_processes[currentProc].state = OS_PS_BLOCKED;
+	os_readyMask &= ~(1 << currentProc);
+	os_yield();
+	os_leaveCriticalSection();
+}
+
+/*!
+ *  Makes a blocked process ready again, processes in other states are left
+ *  alone.
+ *
+ *  \param pid The ID of the process to wake up.
+ */
+void os_unblock(ProcessID pid) {
+	os_enterCriticalSection();
+	if(os_processes[pid].state == OS_PS_BLOCKED){
+		os_processes[pid].state = OS_PS_READY;
+		os_readyMask |= (1 << pid);
+		os_sleepMask &= ~(1 << pid);
+		os_stats_ready(pid);
+	}
+	os_leaveCriticalSection();
+}
+
+/*!
+ *  Moves the end of the current time slice close to the current Timer 2
+ *  count. ISRs call this after making a process ready, which otherwise
+ *  waits for the rest of the slice (up to SCHEDULER_IDLE_PERIOD while idle
+ *  runs). The compare value is put two counts ahead, so the count cannot
+ *  pass it before it is written. The next slice has its regular length
+ *  again.
+ */
+void os_preempt(void) {
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t const compare = TCNT2 + 2;
+	if(compare < OCR2A){
+		OCR2A = compare;
+	}
+	SREG = sreg;
+}
+
+/*!
+ *  Blocks the current process for at least the given time, in steps of one
+ *  Timer 0 overflow (~3.3 ms). Other processes run in the meantime, unlike
+ *  with delayMs. Must not be called by idle or from an ISR.
+ *
+ *  \param ms The time to sleep in milliseconds, 0 just yields.
+ */
+void os_sleep(Time ms) {
+	if(ms == 0){
+		os_yield();
+		return;
+	}
+	
+	// Round up to whole overflows, plus the one that is already running
+	Time overflows = (ms / 1000) * TC0_OVERFLOWS_PER_S + ((ms % 1000) * TC0_OVERFLOWS_PER_S + 999) / 1000 + 1;
+	
+	os_enterCriticalSection();
+	Time now = os_systemTime_overflowCount();
+	Time deadline = now + overflows;
+	
+	// The wake-up time has 16 bits, so long sleeps are done in several steps
+	while((int32_t)(deadline - now) > 0){
+		Time remaining = deadline - now;
+		os_wakeupTime[currentProc] = (uint16_t)(now + ((remaining > INT16_MAX) ? INT16_MAX : remaining));
+		os_sleepMask |= (1 << currentProc);
+		os_block();
+		now = os_systemTime_overflowCount();
+	}
+	os_leaveCriticalSection();
+}
+
 bool os_kill(ProcessID pid)
 {
 	// Check if the provided process ID is out of bounds (lower or upper limit). If it is, return false.
@@ -401,16 +669,20 @@ bool os_kill(ProcessID pid)
 		
 		// Set the state of the process to unused, effectively "killing" it
 		os_processes[pid].state = OS_PS_UNUSED;
+		os_readyMask &= ~(1 << pid);
+		os_sleepMask &= ~(1 << pid);
+		
+		// Transfers on the bus may still write to the stack of the process
+		os_spi_release(pid);
 		
 		// Garbage collection
 		os_freeProcessMemory(intHeap, pid);
 		os_freeProcessMemory(extHeap, pid);
-		os_processes[pid].allocFrameStartInt = 0x0471;// intHeap__.startMapAddr + intHeap__.sizeMap - 1;
-		os_processes[pid].allocFrameEndInt = 0x022c;// intHeap__.startMapAddr;
-		os_processes[pid].allocFrameStartExt = 0xffff;// extHeap__.startMapAddr + extHeap__.sizeMap - 1;
-		os_processes[pid].allocFrameEndExt = 0x0000;// extHeap__.startMapAddr;
 		// -----------------------------------
 		
+		// Mutexes the process holds must not stay locked forever
+		os_sync_release(pid);
+		
 		// If the process being killed is the currently running one, reset the critical section count
 		if(pid == os_getCurrentProc())
 		criticalSectionCount = 1;
@@ -15,6 +15,7 @@
 
 #include "defines.h"
 #include "os_process.h"
+#include "util.h"
 
 //----------------------------------------------------------------------------
 // Types
@@ -29,6 +30,17 @@ typedef enum SchedulingStrategy {
     OS_SS_INACTIVE_AGING
 } SchedulingStrategy;
 
+#if MAX_NUMBER_OF_PROCESSES > 8
+#error "os_readyMask holds one bit per process"
+#endif
+
+//----------------------------------------------------------------------------
+// Globals
+//----------------------------------------------------------------------------
+
+//! Bit mask of the ready or running processes (bit i for process i)
+extern uint8_t os_readyMask;
+
 //----------------------------------------------------------------------------
 // Function headers
 //----------------------------------------------------------------------------
@@ -63,6 +75,21 @@ StackChecksum os_getStackChecksum(ProcessID pid);
 //! Kill the process and by freeing its place in the os_processes[] array
 bool os_kill (ProcessID pid);
 
+//! Gives the rest of the current time slice to the next process
+void os_yield(void);
+
+//! Blocks the current process until os_unblock is called for it
+void os_block(void);
+
+//! Makes a blocked process ready again
+void os_unblock(ProcessID pid);
+
+//! Ends the current time slice within two Timer 2 counts, for ISRs that made a process ready
+void os_preempt(void);
+
+//! Blocks the current process for at least the given time
+void os_sleep(Time ms);
+
 //----------------------------------------------------------------------------
 // Critical section management
 //----------------------------------------------------------------------------
@@ -73,4 +100,47 @@ void os_enterCriticalSection(void);
 //! Leaves a critical code section
 void os_leaveCriticalSection(void);
 
+//! Nesting depth of critical sections (owned by os_scheduler.c)
+extern uint8_t criticalSectionCount;
+
+/*!
+ *  Inlined os_enterCriticalSection for hot paths. Entering a nested section
+ *  only counts up, as the scheduler is disabled already. ISRs that use
+ *  critical sections leave the count as they found it, so the increment need
+ *  not be atomic. The first section and the overflow check take the call.
+ */
+static inline void os_enterCriticalSectionFast(void) {
+	if (criticalSectionCount != 0 && criticalSectionCount != 255) {
+		criticalSectionCount++;
+	} else {
+		os_enterCriticalSection();
+	}
+}
+
+/*!
+ *  Inlined os_leaveCriticalSection for hot paths. Leaving a nested section
+ *  only counts down, leaving the outermost one (which enables the scheduler
+ *  again) and the underflow check take the call.
+ */
+static inline void os_leaveCriticalSectionFast(void) {
+	if (criticalSectionCount > 1) {
+		criticalSectionCount--;
+	} else {
+		os_leaveCriticalSection();
+	}
+}
+
+/*!
+ *  Runs the following statement or block in a critical section, e.g.
+ *  `OS_CRITICAL_SECTION { ... }`. Leaving the block with return, break or
+ *  goto skips leaving the section and must not be done.
+ */
+#define OS_CRITICAL_SECTION \
+	for (uint8_t os_cs_once__ = (os_enterCriticalSectionFast(), 1); os_cs_once__; os_cs_once__ = (os_leaveCriticalSectionFast(), 0))
+
+//! Whether the caller is inside a critical code section
+static inline bool os_isInCriticalSection(void) {
+	return criticalSectionCount != 0;
+}
+
 #endif
@@ -53,6 +53,29 @@ void os_resetProcessSchedulingInformation(ProcessID id) {
 	schedulingInfo.age[id] = 0;
 }
 
+/*!
+ *  Index of the lowest set bit of a process mask in three steps, the
+ *  find-first-set the AVR lacks.
+ *
+ *  \param mask A bit mask of processes that must not be 0.
+ *  \return The lowest process ID contained in mask.
+ */
+static ProcessID lowestProcess(uint8_t mask) {
+	ProcessID pid = 0;
+	if(!(mask & 0x0F)){
+		mask >>= 4;
+		pid += 4;
+	}
+	if(!(mask & 0x03)){
+		mask >>= 2;
+		pid += 2;
+	}
+	if(!(mask & 0x01)){
+		pid += 1;
+	}
+	return pid;
+}
+
 /*!
  *  This function implements the even strategy. Every process gets the same
  *  amount of processing time and is rescheduled after each scheduler call
@@ -64,32 +87,16 @@ void os_resetProcessSchedulingInformation(ProcessID id) {
  *  \return The next process to be executed determined on the basis of the even strategy.
  */
 ProcessID os_Scheduler_Even(Process const processes[], ProcessID current) {
-  //  #warning IMPLEMENT STH. HERE
-  //var rdy will be set on 0, it counts the amount of processes in the state "ready" 
-  uint8_t rdy = 0;
-  //loop which goes through the processlist and checks for every process if it's ready
-  for(uint8_t i = 1; i<MAX_NUMBER_OF_PROCESSES; i++){
-	  //if the current checked process is ready "rdy" will be incremented by one
-	  if(processes[i].state == OS_PS_READY){
-		  rdy++;
-	  }
-  }
-  //if no process is ready return 0 (ID of idle)
-  if(rdy == 0){return 0;}
-  //a second loop that start on the latest runned process and goes through the rest of processes
-  for(uint8_t i = current+1; i<=MAX_NUMBER_OF_PROCESSES; i++){
-	//if the end of the processlist has been reached the index will be reseted to the beginning of the list (0 is reserved for idle) 
-	  if(i==MAX_NUMBER_OF_PROCESSES){
-		  i=1;
-	  }
-	  //if the current process is on "ready" return its I, that's the next process that will be running
-	  if(processes[i].state == OS_PS_READY){
-		  return i;
-	  }
-  }
-  //if no process has been found return 0 (idle)
-  return 0;
-  }
+	// all ready processes except for idle
+	uint8_t ready = os_readyMask & ~1;
+	//if no process is ready return 0 (ID of idle)
+	if(ready == 0){
+		return 0;
+	}
+	// the ready processes behind the current one, if there are none start again at the beginning of the list
+	uint8_t behind = ready & (0xFF << (current + 1));
+	return lowestProcess(behind ? behind : ready);
+}
 
 
 
@@ -102,38 +109,22 @@ ProcessID os_Scheduler_Even(Process const processes[], ProcessID current) {
  *  \return The next process to be executed determined on the basis of the random strategy.
  */
 ProcessID os_Scheduler_Random(Process const processes[], ProcessID current) {
-    //#warning IMPLEMENT STH. HERE
-	//Var randNum saves random number
-	uint16_t randNum = 0;
+	// all ready processes except for idle
+	uint8_t ready = os_readyMask & ~1;
 	//numbers of processes that are ready to be running
-	uint8_t ready = 0;
-	//loop goes through every process
-	for(uint8_t i = 1; i<MAX_NUMBER_OF_PROCESSES; i++){
-		//if current process is ready to run increment "ready"
-		if(processes[i].state == OS_PS_READY){
-			ready++;
-		}
+	uint8_t count = 0;
+	for(uint8_t mask = ready; mask; mask &= mask - 1){
+		count++;
 	}
 	//this checks if no process is ready, if so return process with ID 0 (idle)
-	if(ready == 0){
+	if(count == 0){
 		return 0;
 	}
-	//generates random number between 0 and ready-1 to choose a random process
-	randNum = rand()%ready;
-	//sets ready on 0 again to use it for the next loop
-	ready = 0;
-	//second loop runs again through all processes if current process is ready check if "ready" is = randNum, if so return the ID of the process, 
-	//otherwise increment "ready"
-	for(uint16_t i = 1; i<MAX_NUMBER_OF_PROCESSES; i++ ){
-		if(processes[i].state == OS_PS_READY){
-			if(ready == randNum){
-				return i;
-			}
-			ready++;
-		}
+	//generates random number between 0 and count-1 and drops that many processes from the front of the mask
+	for(uint8_t randNum = rand()%count; randNum > 0; randNum--){
+		ready &= ready - 1;
 	}
-	// if no process has been chosen return ID of the current process
-	return current;
+	return lowestProcess(ready);
 }
 
 
@@ -183,22 +174,19 @@ ProcessID os_Scheduler_InactiveAging(Process const processes[], ProcessID curren
 	// Reset the age of the current process
 	schedulingInfo.age[current] = 0;
 	
-	// Increase the age of every process of its priority 
-	for(ProcessID i = 1; i <= MAX_NUMBER_OF_PROCESSES-1; ++i){
-		if(processes[i].state == OS_PS_READY){
-			schedulingInfo.age[i] += processes[i].priority;
-		}
-	}
-	
+	// Increase the age of every ready process (except for idle) of its priority
+	uint8_t ready = os_readyMask & ~1;
 	ProcessID next = 0;
 	
-	for(ProcessID i = 1; i < MAX_NUMBER_OF_PROCESSES; i++){
-		if(processes[i].state == OS_PS_READY){
-			if(schedulingInfo.age[i] > schedulingInfo.age[next]){
-				next = i;
-				} else if(schedulingInfo.age[i] == schedulingInfo.age[next] && processes[i].priority > processes[next].priority){
-				next = i;
-			}
+	// Visit them from the lowest ID on, so ties keep the lower ID
+	for(uint8_t mask = ready; mask; mask &= mask - 1){
+		ProcessID i = lowestProcess(mask);
+		schedulingInfo.age[i] += processes[i].priority;
+		
+		if(schedulingInfo.age[i] > schedulingInfo.age[next]){
+			next = i;
+			} else if(schedulingInfo.age[i] == schedulingInfo.age[next] && processes[i].priority > processes[next].priority){
+			next = i;
 		}
 	}
 	
@@ -217,8 +205,8 @@ ProcessID os_Scheduler_InactiveAging(Process const processes[], ProcessID curren
 ProcessID os_Scheduler_RunToCompletion(Process const processes[], ProcessID current) {
     // This is a presence task
 	
-	// if the process is not completed yet, continue with the execution
-    if(processes[current].state == OS_PS_READY){
+	// if the process is not completed yet, continue with the execution (idle only runs while nothing else is ready)
+    if(current != 0 && processes[current].state == OS_PS_READY){
 	    return current;
     }
     else{
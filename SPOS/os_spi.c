@@ -1,9 +1,21 @@
-
 /*
  * os_spi.c
  *
  * Created: 07/06/2023 13:13:16
  *  Author: Mariia Z and Okan
+ *
+ * Interrupt driven SPI engine. Transfers are queued and shifted out byte by
+ * byte from SPI_STC_vect, so a process that waits for a long transfer can be
+ * parked and the others keep running.
+ *
+ * At F_CPU/2 one byte takes 16 cycles, less than entering the ISR. Waiting
+ * callers that must not block (inside a critical section, with interrupts
+ * off, idle or before the scheduler runs) therefore mask the interrupt and
+ * drive the queue themselves by polling SPIF, which is as fast as before.
+ * So do callers whose transfer is shorter than OS_SPI_BLOCK_MIN bytes, for
+ * which two process switches cost more than the transfer. Outside of
+ * critical sections they poll with interrupts off, as another process that
+ * polls meanwhile would step the queue behind their back.
  */ 
 
 
@@ -11,7 +23,90 @@
 
 #include "os_spi.h"
 
+#include <avr/interrupt.h>
+
+//! The transfer on the bus and the last one in the queue, NULL if idle
+static SpiTransfer *volatile os_spi_head;
+static SpiTransfer *os_spi_tail;
+
+//! Index of the byte of the head transfer that is on the bus (header first, then data)
+static uint16_t os_spi_position;
+
+//! The byte of the head transfer at the current position
+static uint8_t os_spi_outByte(SpiTransfer const *transfer) {
+	if (os_spi_position < transfer->headerLength) {
+		return transfer->header[os_spi_position];
+	}
+	return transfer->tx ? transfer->tx[os_spi_position - transfer->headerLength] : transfer->fill;
+}
+
+//! Selects the device of the head transfer and shifts out its first byte
+static void os_spi_start(void) {
+	SpiTransfer *transfer = os_spi_head;
+	os_spi_position = 0;
+	if (transfer->selectPort) {
+		*transfer->selectPort &= ~transfer->selectMask;
+	}
+	SPDR = os_spi_outByte(transfer);
+}
 
+/*!
+ *  Handles a byte that has been shifted: stores it, sends the next one or
+ *  finishes the head transfer and starts the next in the queue. Called from
+ *  the ISR or, with the interrupt masked, by a polling waiter.
+ */
+static void os_spi_step(void) {
+	SpiTransfer *transfer = os_spi_head;
+	uint8_t const in = SPDR;
+	if (os_spi_position >= transfer->headerLength && transfer->rx) {
+		transfer->rx[os_spi_position - transfer->headerLength] = in;
+	}
+	os_spi_position++;
+	if (os_spi_position < transfer->headerLength + transfer->length) {
+		SPDR = os_spi_outByte(transfer);
+		return;
+	}
+
+	if (transfer->selectPort) {
+		*transfer->selectPort |= transfer->selectMask;
+	}
+	os_spi_head = transfer->next;
+	transfer->complete = true;
+	if (transfer->done) {
+		transfer->done(transfer);
+	}
+	if (transfer->waiter != 0) {
+		os_unblock(transfer->waiter);
+		os_preempt();
+	}
+	if (os_spi_head) {
+		os_spi_start();
+	}
+}
+
+ISR(SPI_STC_vect) {
+	os_spi_step();
+}
+
+/*!
+ *  Moves the queue forward by polling SPIF until the transfer is complete.
+ *  The interrupt is masked meanwhile and enabled again with interrupts off.
+ *
+ *  \param transfer A queued transfer.
+ *  \param sreg The status register to poll with, interrupts must only be on
+ *         if no other process can poll meanwhile.
+ */
+static void os_spi_poll(SpiTransfer const *transfer, uint8_t sreg) {
+	SPCR &= ~(1 << SPIE);
+	SREG = sreg;
+	while (!transfer->complete) {
+		if (SPSR & (1 << SPIF)) {
+			os_spi_step();
+		}
+	}
+	cli();
+	SPCR |= (1 << SPIE);
+}
 
 void os_spi_init(){
 	// MOSI, SCK as output 
@@ -21,25 +116,117 @@ void os_spi_init(){
 	// Set SPI2X in state register
 	SPSR |= 0b00000001; 
 
-	// Set SPE and MSTR
+	// Set SPE and MSTR, the transfer complete interrupt is enabled by os_spi_submit
 	SPCR |= 0b01010000;
 }
 
+/*!
+ *  Appends a transfer to the queue. Empty transfers are completed at once.
+ *
+ *  \param transfer The transfer, its header, tx, rx, length, fill, select
+ *         and done fields must be set.
+ */
+void os_spi_submit(SpiTransfer *transfer) {
+	transfer->complete = false;
+	transfer->owner = os_getCurrentProc();
+	transfer->waiter = 0;
+	transfer->next = NULL;
+	if (transfer->headerLength == 0 && transfer->length == 0) {
+		transfer->complete = true;
+		if (transfer->done) {
+			transfer->done(transfer);
+		}
+		return;
+	}
+
+	uint8_t const sreg = SREG;
+	cli();
+	if (os_spi_head) {
+		os_spi_tail->next = transfer;
+		os_spi_tail = transfer;
+	} else {
+		os_spi_head = os_spi_tail = transfer;
+		SPCR |= (1 << SPIE);
+		os_spi_start();
+	}
+	SREG = sreg;
+}
+
+/*!
+ *  Waits until the transfer is complete. Processes outside of critical
+ *  sections are blocked during transfers of OS_SPI_BLOCK_MIN bytes or more,
+ *  and the engine wakes them up and ends the current time slice when it is
+ *  done. Everyone else (idle, code in critical sections or with interrupts
+ *  disabled, short transfers) polls the bus and moves the queue forward
+ *  itself, including transfers queued before this one. If the process is
+ *  killed meanwhile, os_kill completes the transfer on its stack.
+ *
+ *  \param transfer A transfer passed to os_spi_submit before.
+ */
+void os_spi_wait(SpiTransfer *transfer) {
+	uint8_t const sreg = SREG;
+	cli();
+	if ((sreg & (1 << SREG_I)) && !os_isInCriticalSection() && os_getCurrentProc() != 0
+			&& transfer->headerLength + transfer->length >= OS_SPI_BLOCK_MIN) {
+		transfer->waiter = os_getCurrentProc();
+		// Interrupts stay off between the check and blocking, os_block returns with them off
+		while (!transfer->complete) {
+			os_block();
+		}
+	} else {
+		// Only inside a critical section no other process can poll meanwhile
+		os_spi_poll(transfer, os_isInCriticalSection() ? sreg : SREG);
+	}
+	SREG = sreg;
+}
+
+/*!
+ *  Completes the queued transfers of a process that is killed. They live on
+ *  its stack, which is reused by the next process in the slot. Called by
+ *  os_kill.
+ *
+ *  \param pid The ID of the killed process.
+ */
+void os_spi_release(ProcessID pid) {
+	uint8_t const sreg = SREG;
+	cli();
+	SpiTransfer const *last = NULL;
+	for (SpiTransfer const *transfer = os_spi_head; transfer; transfer = transfer->next) {
+		if (transfer->owner == pid) {
+			last = transfer;
+		}
+	}
+	if (last) {
+		os_spi_poll(last, SREG);
+	}
+	SREG = sreg;
+}
+
+//! Submits a transfer and waits for it
+void os_spi_transfer(SpiTransfer *transfer) {
+	os_spi_submit(transfer);
+	os_spi_wait(transfer);
+}
+
+/*!
+ *  Sends a single byte behind the queue, the caller drives the chip select
+ *  line.
+ *
+ *  \param input The byte to send.
+ *  \return The byte received meanwhile.
+ */
 uint8_t os_spi_send(uint8_t input){
-	os_enterCriticalSection();
-	SPDR = input;
-	
-	// Wait for the end of transmission 
-	while((SPSR & (1 << SPIF)) == 0){}
-	
-	uint8_t result = SPDR;
-	
-	os_leaveCriticalSection();
-	
+	uint8_t result;
+	SpiTransfer transfer = {
+		.tx = &input,
+		.rx = &result,
+		.length = 1
+	};
+	os_spi_transfer(&transfer);
 	return result;
 }
 
 
 uint8_t os_spi_receive(){
 	return os_spi_send(0xFF);
-}
\ No newline at end of file
+}
@@ -1,4 +1,3 @@
-
 /*
  * os_spi.h
  *
@@ -14,11 +13,51 @@
 
 #include "os_scheduler.h"
 #include <avr/io.h>
+#include <stdbool.h>
 #include <stdint.h>
 
+typedef struct SpiTransfer SpiTransfer;
+
+//! Called from the SPI interrupt (or the waiting process) when a transfer is done
+typedef void SpiCallback(SpiTransfer *transfer);
+
+/*!
+ *  One transfer of the SPI engine: the header bytes, then length data bytes,
+ *  all with the chip select line held low. Received header bytes are dropped.
+ *  The descriptor belongs to the engine from os_spi_submit until complete is
+ *  set and must stay valid that long.
+ */
+struct SpiTransfer {
+	uint8_t header[4];		//!< Command and address bytes sent first
+	uint8_t headerLength;		//!< Number of valid header bytes
+	uint8_t const *tx;		//!< Data to send, NULL to send fill instead
+	uint8_t *rx;			//!< Where to put the received data, NULL to drop it
+	uint16_t length;		//!< Number of data bytes
+	uint8_t fill;			//!< Sent for every data byte if tx is NULL
+	volatile uint8_t *selectPort;	//!< Port of the chip select line, NULL if the caller drives it
+	uint8_t selectMask;		//!< Bit of the chip select line in selectPort
+	SpiCallback *done;		//!< Called when the transfer is done, may be NULL
+	volatile bool complete;		//!< Set by the engine when the transfer is done
+	ProcessID owner;		//!< Process that submitted the transfer (set by os_spi_submit)
+	ProcessID waiter;		//!< Process unblocked when the transfer is done (set by os_spi_wait)
+	SpiTransfer *next;		//!< Next transfer in the queue (used by the engine)
+};
+
 //! Initializes the SPI and configures the relevant registers
 void os_spi_init();
 
+//! Queues a transfer, which starts right away if the bus is free
+void os_spi_submit(SpiTransfer *transfer);
+
+//! Waits for a submitted transfer, parking the caller if it may block
+void os_spi_wait(SpiTransfer *transfer);
+
+//! Submits a transfer and waits for it
+void os_spi_transfer(SpiTransfer *transfer);
+
+//! Completes the queued transfers of a process that is killed
+void os_spi_release(ProcessID pid);
+
 //! Performs the data transmission
 uint8_t os_spi_send(uint8_t input);
 
@@ -26,4 +65,4 @@ uint8_t os_spi_send(uint8_t input);
 uint8_t os_spi_receive();
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,138 @@
+/*! \file
+ *
+ * Bookkeeping behind os_stats.h. The hooks are called from the scheduler ISR
+ * (and from os_exec/os_unblock for os_stats_ready), so they must stay short:
+ * every hook reads the Timer 0 time once and does a few additions.
+ */
+
+#include "os_stats.h"
+
+#if OS_CPU_STATS
+
+#include "os_scheduler.h"
+
+//! Counters of every process slot
+static ProcessStats os_stats[MAX_NUMBER_OF_PROCESSES];
+
+//! When each process last became ready
+static Time os_stats_readySince[MAX_NUMBER_OF_PROCESSES];
+
+//! Histogram of the scheduler run times
+static uint16_t os_stats_isrHistogram[OS_STATS_ISR_BINS];
+
+//! When the running process got the CPU
+static Time os_stats_runningSince;
+
+//! When the scheduler ISR was entered
+static Time os_stats_isrStart;
+
+//! The process that was running when the scheduler ISR was entered
+static ProcessID os_stats_previous;
+
+//! Adds one to a counter unless it is saturated
+static void increment(uint16_t *counter) {
+	if (*counter != UINT16_MAX) {
+		(*counter)++;
+	}
+}
+
+//! Clears all counters and the histogram
+void os_stats_reset(void) {
+	for (ProcessID pid = 0; pid < MAX_NUMBER_OF_PROCESSES; pid++) {
+		os_stats_initProcess(pid);
+	}
+	for (uint8_t bin = 0; bin < OS_STATS_ISR_BINS; bin++) {
+		os_stats_isrHistogram[bin] = 0;
+	}
+}
+
+/*!
+ *  Counters of a process slot. They belong to the last process that ran in
+ *  this slot until a new one is started.
+ *
+ *  \param pid The process slot.
+ *  \return The counters (read only).
+ */
+ProcessStats const* os_stats_process(ProcessID pid) {
+	return &os_stats[pid];
+}
+
+/*!
+ *  Reads one bin of the scheduler run time histogram. Bin b counts the runs
+ *  that took less than 2^b Timer 0 counts but at least 2^(b-1), the last bin
+ *  also counts all longer runs.
+ *
+ *  \param bin The bin (0 to OS_STATS_ISR_BINS-1).
+ *  \return The number of runs, saturating at UINT16_MAX.
+ */
+uint16_t os_stats_isrCount(uint8_t bin) {
+	return os_stats_isrHistogram[bin];
+}
+
+//! Clears the counters of a slot that gets a new process
+void os_stats_initProcess(ProcessID pid) {
+	os_stats[pid].cpuTime = 0;
+	os_stats[pid].scheduled = 0;
+	os_stats[pid].preempted = 0;
+	os_stats[pid].maxLatency = 0;
+}
+
+/*!
+ *  Called by the scheduler right after the context of pid was saved. The
+ *  time since pid got the CPU is added to its account.
+ *
+ *  \param pid The process that ran until now.
+ */
+void os_stats_leave(ProcessID pid) {
+	os_stats_isrStart = os_systemTime_ticks();
+	os_stats[pid].cpuTime += os_stats_isrStart - os_stats_runningSince;
+	os_stats_previous = pid;
+}
+
+//! Restarts the scheduler run time measurement after the task manager was closed
+void os_stats_skipTaskMan(void) {
+	os_stats_isrStart = os_systemTime_ticks();
+}
+
+/*!
+ *  Remembers when pid became ready, to measure how long it waits.
+ *
+ *  \param pid The process that became ready.
+ */
+void os_stats_ready(ProcessID pid) {
+	os_stats_readySince[pid] = os_systemTime_ticks();
+}
+
+/*!
+ *  Called by the scheduler right before pid is resumed. Counts the switch
+ *  and the run time of the scheduler.
+ *
+ *  \param pid The process that gets the CPU.
+ */
+void os_stats_enter(ProcessID pid) {
+	Time now = os_systemTime_ticks();
+
+	if (pid != os_stats_previous) {
+		Time latency = now - os_stats_readySince[pid];
+		if (latency > os_stats[pid].maxLatency) {
+			os_stats[pid].maxLatency = (latency > UINT16_MAX) ? UINT16_MAX : latency;
+		}
+		increment(&os_stats[pid].scheduled);
+		if (os_isRunnable(os_getProcessSlot(os_stats_previous))) {
+			increment(&os_stats[os_stats_previous].preempted);
+		}
+	}
+
+	// Index of the highest set bit of the run time, capped at the last bin
+	Time duration = now - os_stats_isrStart;
+	uint8_t bin = 0;
+	while (duration && bin < OS_STATS_ISR_BINS - 1) {
+		duration >>= 1;
+		bin++;
+	}
+	increment(&os_stats_isrHistogram[bin]);
+
+	os_stats_runningSince = now;
+}
+
+#endif
@@ -0,0 +1,66 @@
+/*! \file
+ *  \brief CPU accounting of the processes and run times of the scheduler.
+ *
+ *  The scheduler ISR reports every process switch here. Times are kept in
+ *  Timer 0 counts (TC0_PRESCALER cycles, 12.8 us at 20 MHz), see
+ *  os_systemTime_ticks. Everything in here is only compiled if OS_CPU_STATS
+ *  is set, otherwise the hooks expand to nothing.
+ */
+
+#ifndef _OS_STATS_H
+#define _OS_STATS_H
+
+#include "defines.h"
+#include "os_process.h"
+#include "util.h"
+
+#include <stdint.h>
+
+//! Number of bins of the scheduler run time histogram
+#define OS_STATS_ISR_BINS 8
+
+//! What the scheduler observed about one process slot
+typedef struct {
+	Time cpuTime;		//!< Time the process ran (Timer 0 counts)
+	uint16_t scheduled;	//!< Times the process was switched to
+	uint16_t preempted;	//!< Times the process was switched away from while still runnable
+	uint16_t maxLatency;	//!< Longest time from becoming ready to running (Timer 0 counts, saturating)
+} ProcessStats;
+
+#if OS_CPU_STATS
+
+//! Clears all counters and the histogram
+void os_stats_reset(void);
+
+//! Counters of a process slot
+ProcessStats const* os_stats_process(ProcessID pid);
+
+//! Number of scheduler runs that took less than 2^bin Timer 0 counts (the last bin takes all longer runs)
+uint16_t os_stats_isrCount(uint8_t bin);
+
+//! Clears the counters of a slot that gets a new process
+void os_stats_initProcess(ProcessID pid);
+
+//! Hook: the scheduler ISR was entered and pid lost the CPU
+void os_stats_leave(ProcessID pid);
+
+//! Hook: the task manager was shown, its time is not taken as scheduler run time
+void os_stats_skipTaskMan(void);
+
+//! Hook: pid became ready
+void os_stats_ready(ProcessID pid);
+
+//! Hook: the scheduler ISR is left and pid gets the CPU
+void os_stats_enter(ProcessID pid);
+
+#else
+
+#define os_stats_initProcess(pid) ((void)0)
+#define os_stats_leave(pid) ((void)0)
+#define os_stats_skipTaskMan() ((void)0)
+#define os_stats_ready(pid) ((void)0)
+#define os_stats_enter(pid) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,245 @@
+/*! \file
+ *
+ * Semaphores and mutexes on top of os_block/os_unblock. Every primitive keeps
+ * a bit mask of its waiters. A woken waiter checks the condition again, so a
+ * waiter that was killed (or a slot that was reused meanwhile) only costs a
+ * spurious wake-up. os_kill unlocks the mutexes of the killed process.
+ *
+ * The mutexes a process holds are chained through Mutex.next. Its own
+ * priority is kept aside when it locks the first of them, and on every unlock
+ * it runs with the highest priority of that and of the waiters of the
+ * mutexes it still holds.
+ */
+
+#include "os_sync.h"
+#include "os_core.h"
+
+//! The mutexes each process holds, the last one locked first
+static Mutex *heldMutexes[MAX_NUMBER_OF_PROCESSES];
+
+//! The priority each process had before it locked the mutexes it holds
+static Priority basePriority[MAX_NUMBER_OF_PROCESSES];
+
+/*!
+ *  Finds the most urgent waiter of a waiter mask. Bits of processes that are
+ *  no longer blocked are dropped on the way.
+ *
+ *  \param waiting The waiter mask of a primitive.
+ *  \return The waiter with the highest priority or INVALID_PROCESS.
+ */
+static ProcessID mostUrgentWaiter(uint8_t *waiting) {
+	ProcessID next = INVALID_PROCESS;
+
+	for (ProcessID pid = 1; pid < MAX_NUMBER_OF_PROCESSES; pid++) {
+		if (!(*waiting & (1 << pid))) {
+			continue;
+		}
+		Process const* proc = os_getProcessSlot(pid);
+		if (proc->state != OS_PS_BLOCKED) {
+			*waiting &= ~(1 << pid);
+		} else if (next == INVALID_PROCESS || proc->priority > os_getProcessSlot(next)->priority) {
+			next = pid;
+		}
+	}
+	return next;
+}
+
+/*!
+ *  Removes the most urgent waiter from a waiter mask and makes it ready.
+ *
+ *  \param waiting The waiter mask of a primitive.
+ */
+static void wakeWaiter(uint8_t *waiting) {
+	ProcessID next = mostUrgentWaiter(waiting);
+
+	if (next != INVALID_PROCESS) {
+		*waiting &= ~(1 << next);
+		os_unblock(next);
+	}
+}
+
+/*!
+ *  Initializes a semaphore.
+ *
+ *  \param sem The semaphore.
+ *  \param count The number of units available at the beginning.
+ */
+void os_semInit(Semaphore *sem, uint8_t count) {
+	sem->count = count;
+	sem->waiting = 0;
+}
+
+/*!
+ *  Takes one unit of the semaphore. If there is none, the current process is
+ *  blocked until another process signals the semaphore.
+ *
+ *  \param sem The semaphore.
+ */
+void os_semWait(Semaphore *sem) {
+	os_enterCriticalSection();
+	while (sem->count == 0) {
+		sem->waiting |= (1 << os_getCurrentProc());
+		os_block();
+	}
+	sem->count--;
+	os_leaveCriticalSection();
+}
+
+/*!
+ *  Takes one unit of the semaphore without blocking.
+ *
+ *  \param sem The semaphore.
+ *  \return True if a unit was taken.
+ */
+bool os_semTryWait(Semaphore *sem) {
+	bool taken = false;
+
+	os_enterCriticalSection();
+	if (sem->count > 0) {
+		sem->count--;
+		taken = true;
+	}
+	os_leaveCriticalSection();
+	return taken;
+}
+
+/*!
+ *  Returns one unit to the semaphore and wakes up the waiter with the highest
+ *  priority.
+ *
+ *  \param sem The semaphore.
+ */
+void os_semSignal(Semaphore *sem) {
+	os_enterCriticalSection();
+	if (sem->count == 255) {
+		os_error("Semaphore overflow");
+	} else {
+		sem->count++;
+		wakeWaiter(&sem->waiting);
+	}
+	os_leaveCriticalSection();
+}
+
+/*!
+ *  Initializes a mutex as free.
+ *
+ *  \param mutex The mutex.
+ */
+void os_mutexInit(Mutex *mutex) {
+	mutex->owner = INVALID_PROCESS;
+	mutex->waiting = 0;
+	mutex->next = NULL;
+}
+
+/*!
+ *  Makes the current process the owner of a free mutex.
+ *
+ *  \param mutex The mutex.
+ */
+static void takeMutex(Mutex *mutex) {
+	ProcessID self = os_getCurrentProc();
+
+	// Only a process that holds mutexes is ever raised, so this is its own priority
+	if (heldMutexes[self] == NULL) {
+		basePriority[self] = os_getProcessSlot(self)->priority;
+	}
+	mutex->owner = self;
+	mutex->next = heldMutexes[self];
+	heldMutexes[self] = mutex;
+}
+
+/*!
+ *  Locks the mutex. While another process holds it, the current process is
+ *  blocked and the owner runs with at least the priority of the current
+ *  process.
+ *
+ *  \param mutex The mutex.
+ */
+void os_mutexLock(Mutex *mutex) {
+	os_enterCriticalSection();
+	ProcessID self = os_getCurrentProc();
+
+	if (mutex->owner == self) {
+		os_error("Mutex locked twice");
+		os_leaveCriticalSection();
+		return;
+	}
+	while (mutex->owner != INVALID_PROCESS) {
+		Process* owner = os_getProcessSlot(mutex->owner);
+		Priority priority = os_getProcessSlot(self)->priority;
+		if (owner->priority < priority) {
+			owner->priority = priority;
+		}
+		mutex->waiting |= (1 << self);
+		os_block();
+	}
+	takeMutex(mutex);
+	os_leaveCriticalSection();
+}
+
+/*!
+ *  Locks the mutex without blocking.
+ *
+ *  \param mutex The mutex.
+ *  \return True if the mutex was free and is now held by the current process.
+ */
+bool os_mutexTryLock(Mutex *mutex) {
+	bool locked = false;
+
+	os_enterCriticalSection();
+	if (mutex->owner == INVALID_PROCESS) {
+		takeMutex(mutex);
+		locked = true;
+	}
+	os_leaveCriticalSection();
+	return locked;
+}
+
+/*!
+ *  Unlocks the mutex and wakes up the waiter with the highest priority. The
+ *  priority inherited through this mutex is dropped, the one inherited
+ *  through the other mutexes the current process holds is kept.
+ *
+ *  \param mutex The mutex, which must be held by the current process.
+ */
+void os_mutexUnlock(Mutex *mutex) {
+	os_enterCriticalSection();
+	ProcessID self = os_getCurrentProc();
+
+	if (mutex->owner != self) {
+		os_error("Mutex not owned");
+	} else {
+		Mutex **link = &heldMutexes[self];
+		while (*link != mutex) {
+			link = &(*link)->next;
+		}
+		*link = mutex->next;
+		mutex->owner = INVALID_PROCESS;
+		wakeWaiter(&mutex->waiting);
+
+		Priority priority = basePriority[self];
+		for (Mutex *held = heldMutexes[self]; held != NULL; held = held->next) {
+			ProcessID waiter = mostUrgentWaiter(&held->waiting);
+			if (waiter != INVALID_PROCESS && os_getProcessSlot(waiter)->priority > priority) {
+				priority = os_getProcessSlot(waiter)->priority;
+			}
+		}
+		os_getProcessSlot(self)->priority = priority;
+	}
+	os_leaveCriticalSection();
+}
+
+/*!
+ *  Unlocks the mutexes held by a process that is killed and wakes up one
+ *  waiter of each. Called by os_kill, so the slot is reused with a clean
+ *  state.
+ *
+ *  \param pid The ID of the killed process.
+ */
+void os_sync_release(ProcessID pid) {
+	for (Mutex *held = heldMutexes[pid]; held != NULL; held = held->next) {
+		held->owner = INVALID_PROCESS;
+		wakeWaiter(&held->waiting);
+	}
+	heldMutexes[pid] = NULL;
+}
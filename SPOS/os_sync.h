@@ -0,0 +1,60 @@
+/*! \file
+ *  \brief Blocking synchronisation primitives.
+ *
+ *  Counting semaphores and mutexes whose waiters are taken out of the
+ *  scheduling (OS_PS_BLOCKED) instead of spinning. The waiter with the
+ *  highest priority is woken first. Mutexes lend the priority of their
+ *  most urgent waiter to the owner (priority inheritance), so a low priority
+ *  owner is not starved by processes of medium priority.
+ *  None of these functions may be called by idle or from an ISR.
+ */
+
+#ifndef _OS_SYNC_H
+#define _OS_SYNC_H
+
+#include "os_scheduler.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//! A counting semaphore
+typedef struct {
+	uint8_t count;
+	uint8_t waiting;	//!< Bit i is set while process i waits
+} Semaphore;
+
+//! A (non-recursive) mutex
+typedef struct Mutex {
+	ProcessID owner;	//!< INVALID_PROCESS while the mutex is free
+	uint8_t waiting;	//!< Bit i is set while process i waits
+	struct Mutex *next;	//!< Next mutex held by the same owner
+} Mutex;
+
+//! Initializes a semaphore with the given number of units
+void os_semInit(Semaphore *sem, uint8_t count);
+
+//! Takes a unit, blocks until one is available
+void os_semWait(Semaphore *sem);
+
+//! Takes a unit if one is available
+bool os_semTryWait(Semaphore *sem);
+
+//! Returns a unit and wakes up a waiter
+void os_semSignal(Semaphore *sem);
+
+//! Initializes a free mutex
+void os_mutexInit(Mutex *mutex);
+
+//! Locks the mutex, blocks while another process holds it
+void os_mutexLock(Mutex *mutex);
+
+//! Locks the mutex if it is free
+bool os_mutexTryLock(Mutex *mutex);
+
+//! Unlocks the mutex held by the current process
+void os_mutexUnlock(Mutex *mutex);
+
+//! Unlocks all mutexes of a process that is killed
+void os_sync_release(ProcessID pid);
+
+#endif
@@ -39,7 +39,13 @@ Page specification;
 #include "os_user_privileges.h"
 #if (VERSUCH >= 3)
     #include "os_memory.h"
+    #include "os_memory_index.h"
+    #include "os_memory_buddy.h"
+    #include "os_memory_handles.h"
+    #include "os_memory_owners.h"
+    #include "os_memory_stats.h"
 #endif
+#include "os_stats.h"
 
 #pragma GCC push_options
 #pragma GCC optimize ("O3")
@@ -80,6 +86,11 @@ Program* os_getProgramSlot(Program);
  */
 #define TM_COMPILE_HEAP_SUPPORT (VERSUCH >= 3)
 
+/*!
+ *  Does the scheduler keep CPU statistics (see os_stats.h)?
+ */
+#define TM_COMPILE_STATS_SUPPORT (OS_CPU_STATS)
+
 /*!
  *  The number of main-pages of the TM. Actually, this is set by
  *  the respective page-handler at runtime.
@@ -100,6 +111,25 @@ Program* os_getProgramSlot(Program);
  */
 #define TM_MAP_ENTRIES_PER_PAGE 20
 
+/*!
+ *  How many bytes the heap eraser clears with one call of the fill driver
+ *  function. Larger blocks mean less overhead but a coarser progress bar.
+ */
+#define TM_ERASE_BLOCK 64
+
+/*!
+ *  Index of the first per-process page of the allocation statistics and
+ *  number of their pages: fragmentation, totals, requested bytes and strategy
+ *  time, one page per process slot and resetting the counters. Without
+ *  OS_MEM_STATS only the fragmentation is shown.
+ */
+#if OS_MEM_STATS
+#define TM_HEAP_STATS_PROCS 3
+#define TM_HEAP_STATS_PAGES (TM_HEAP_STATS_PROCS + MAX_NUMBER_OF_PROCESSES + 1)
+#else
+#define TM_HEAP_STATS_PAGES 1
+#endif
+
 /*!
  *  This is a wrapper for the os_getInput function of the os_input module.
  *  It is never used directly but utilizes a macro to use a stack variable as inputBuffer.
@@ -439,6 +469,7 @@ char PROGMEM const mainLabels[] =
     "Change Priority                \0"
     "Change Scheduling Strategy     \0"
     "Heap(s)                        \0"
+    "CPU statistics                 \0"
 ;
 
 // Forward declarations for the sub-pages of the root-page.
@@ -460,6 +491,10 @@ static tm_page tm_scheduling;
 static tm_page tm_heap;
 #endif
 
+#if TM_COMPILE_STATS_SUPPORT
+static tm_page tm_stats;
+#endif
+
 static tm_page tm_null;
 
 // A convenience macro to access the stack-history.
@@ -482,7 +517,7 @@ static tm_page tm_null;
 #endif
 
 #if TM_COMPILE_HEAP_SUPPORT
-#define MS_MAX_COUNT (MAX4(OS_MEM_FIRST, OS_MEM_NEXT, OS_MEM_BEST, OS_MEM_WORST) + 1)
+#define MS_MAX_COUNT (MAX5(OS_MEM_FIRST, OS_MEM_NEXT, OS_MEM_BEST, OS_MEM_WORST, OS_MEM_BUDDY) + 1)
 #endif
 
 /*!
@@ -518,6 +553,9 @@ static TM_PAGE(tm_rootpage) {
 #if TM_COMPILE_HEAP_SUPPORT
         SUBP(4, tm_heap, 0, TM_HEAP_SUPPORT)
 #endif
+#if TM_COMPILE_STATS_SUPPORT
+        SUBP(5, tm_stats, os_getCurrentProc(), MAX_NUMBER_OF_PROCESSES + 2)
+#endif
 #undef SUBP
         default:
             result->child.call = tm_null;
@@ -981,6 +1019,89 @@ make_pagehandler(tm_scheduling_set, tm_null, 0, 0, OS_PR_SCHEDULING, ss, peekSta
 
 #endif
 
+#if TM_COMPILE_STATS_SUPPORT
+
+// Forward declarations
+static tm_page tm_stats_isr;
+static tm_page tm_stats_reset;
+
+/*!
+ *  The page to show the CPU statistics of a process: its share of the CPU time,
+ *  the longest time it waited to run after becoming ready, and how often it
+ *  was scheduled and preempted. The two indices behind the processes lead to
+ *  the histogram of the scheduler run times and to resetting all counters.
+ */
+make_pagehandler(tm_stats, tm_null, 0, 0, OS_PR_ALWAYS_ALLOW, null, 0) {
+    uint16_t const page = peekStack(0).param;
+    if (page == MAX_NUMBER_OF_PROCESSES) {
+        lcd_writeProgString(PSTR("Scheduler run   time histogram"));
+        result->call = tm_stats_isr;
+        result->param = 0;
+        result->range = OS_STATS_ISR_BINS;
+        return true;
+    }
+    if (page == MAX_NUMBER_OF_PROCESSES + 1) {
+        lcd_writeProgString(PSTR("Reset statistics"));
+        result->call = tm_stats_reset;
+        result->param = 0;
+        result->range = 1;
+        return true;
+    }
+    if (os_getProcessSlot(page)->state == OS_PS_UNUSED) {
+        return false;
+    }
+
+    ProcessStats const* stats = os_stats_process(page);
+    Time total = 0;
+    for (ProcessID pid = 0; pid < MAX_NUMBER_OF_PROCESSES; pid++) {
+        total += os_stats_process(pid)->cpuTime;
+    }
+    lcd_writeChar('#');
+    lcd_writeDec(page);
+    lcd_writeChar(' ');
+    lcd_writeDec((total >= 100) ? (stats->cpuTime / (total / 100)) : 0);
+    lcd_writeProgString(PSTR("% L:"));
+    lcd_writeDec(((uint32_t)stats->maxLatency * TC0_PRESCALER) / (F_CPU / 1000ul));
+    lcd_writeProgString(PSTR("ms"));
+    lcd_line2();
+    lcd_writeProgString(PSTR("S:"));
+    lcd_writeDec(stats->scheduled);
+    lcd_writeProgString(PSTR(" P:"));
+    lcd_writeDec(stats->preempted);
+    return true;
+}
+
+/*!
+ *  The page to show one bin of the scheduler run time histogram.
+ */
+make_pagehandler(tm_stats_isr, tm_null, 0, 0, OS_PR_ALWAYS_ALLOW, null, 0) {
+    uint8_t const bin = peekStack(0).param;
+    if (bin < OS_STATS_ISR_BINS - 1) {
+        lcd_writeProgString(PSTR("ISR < "));
+        lcd_writeDec((((uint32_t)1 << bin) * TC0_PRESCALER) / (F_CPU / 1000000ul));
+    } else {
+        lcd_writeProgString(PSTR("ISR >= "));
+        lcd_writeDec((((uint32_t)1 << (bin - 1)) * TC0_PRESCALER) / (F_CPU / 1000000ul));
+    }
+    lcd_writeProgString(PSTR("us"));
+    lcd_line2();
+    lcd_writeProgString(PSTR("runs: "));
+    lcd_writeDec(os_stats_isrCount(bin));
+    return true;
+}
+
+/*!
+ *  The page to clear all CPU statistics.
+ */
+make_pagehandler(tm_stats_reset, tm_null, 0, 0, OS_PR_ALWAYS_ALLOW, null, 0) {
+    lcd_writeProgString(PSTR("Resetting..."));
+    os_stats_reset();
+    tm_done();
+    return true;
+}
+
+#endif
+
 #if TM_COMPILE_HEAP_SUPPORT
 
 static const char *getHeapName(uint8_t ram) {
@@ -991,7 +1112,7 @@ static const char *getHeapName(uint8_t ram) {
 /*!
  *  The page to select which heap to inspect. Supports NULL-heaps.
  */
-make_pagehandler(tm_heap, tm_heap2, 0, 4, OS_PR_SHOW_HEAP, heapId, peekStack(0).param) {
+make_pagehandler(tm_heap, tm_heap2, 0, 5, OS_PR_SHOW_HEAP, heapId, peekStack(0).param) {
     uint16_t const ram = peekStack(0).param;
     if (ram >= os_getHeapListLength() || !os_lookupHeap(ram)) {
         return false;
@@ -1006,6 +1127,7 @@ make_pagehandler(tm_heap, tm_heap2, 0, 4, OS_PR_SHOW_HEAP, heapId, peekStack(0).
 static tm_page tm_heap_strategy;
 static tm_page tm_heap_contents;
 static tm_page tm_heap_chunks;
+static tm_page tm_heap_stats;
 static tm_page tm_heap_erase;
 
 /*!
@@ -1014,6 +1136,7 @@ static tm_page tm_heap_erase;
  *   - select a strategy
  *   - dump the map
  *   - browse chunks
+ *   - show allocation statistics
  *   - erase everything
  */
 make_pagehandler(tm_heap2, tm_heap_strategy, 0, MS_MAX_COUNT, OS_PR_ALWAYS_ALLOW, null, 0) {
@@ -1028,17 +1151,24 @@ make_pagehandler(tm_heap2, tm_heap_strategy, 0, MS_MAX_COUNT, OS_PR_ALWAYS_ALLOW
             lcd_writeProgString(PSTR("Map content dump"));
             result->call = tm_heap_contents;
             result->param = 0;
-            result->range = (os_getUseSize(heap) + TM_MAP_ENTRIES_PER_PAGE - 1) / TM_MAP_ENTRIES_PER_PAGE;
+            result->range = (heap->blockCount + TM_MAP_ENTRIES_PER_PAGE - 1) / TM_MAP_ENTRIES_PER_PAGE;
             break;
         }
         case 2: {
             lcd_writeProgString(PSTR("Chunk browser"));
             result->call = tm_heap_chunks;
             result->param = 0;
-            result->range = os_getUseSize(heap);
+            result->range = heap->blockCount;
             break;
         }
         case 3: {
+            lcd_writeProgString(PSTR("Allocation stats"));
+            result->call = tm_heap_stats;
+            result->param = 0;
+            result->range = TM_HEAP_STATS_PAGES;
+            break;
+        }
+        case 4: {
             lcd_writeProgString(PSTR("Erase everything"));
             result->call = tm_heap_erase;
             result->param = 0;
@@ -1057,6 +1187,7 @@ makeStrategyNameLookup(getAllocationStratNames, 0x10, 0,
     {OS_MEM_NEXT,  PSTR("<Next Fit>     ")},
     {OS_MEM_BEST,  PSTR("<Best Fit>     ")},
     {OS_MEM_WORST, PSTR("<Worst Fit>    ")},
+    {OS_MEM_BUDDY, PSTR("<Buddy>        ")},
 )
 
 /*!
@@ -1081,9 +1212,9 @@ make_pagehandler(tm_heap_strategy_set, tm_null, 0, 0, OS_PR_ALLOCATION, as, peek
                            setAS, heap);
 }
 
-static MemValue derefMap(Heap const* heap, MemAddr usePtr) {
-    uint16_t const uOff = usePtr - os_getUseStart(heap);
-    return (heap->driver->read(os_getMapStart(heap) + uOff / 2) >> (((~uOff) & 1) << 2)) & 0xF;
+//! Map nibble of a block of the use area
+static MemValue derefMap(Heap const* heap, uint16_t block) {
+    return (heap->driver->read(os_getMapStart(heap) + block / 2) >> (((~block) & 1) << 2)) & 0xF;
 }
 
 /*!
@@ -1091,14 +1222,14 @@ static MemValue derefMap(Heap const* heap, MemAddr usePtr) {
  */
 make_pagehandler(tm_heap_contents, tm_null, 0, 0, OS_PR_SHOW_HEAP, null, 0) {
     Heap* const heap = os_lookupHeap(peekStack(2).param);
-    uint16_t addr = os_getUseStart(heap) + peekStack(0).param *  TM_MAP_ENTRIES_PER_PAGE;
+    uint16_t block = peekStack(0).param *  TM_MAP_ENTRIES_PER_PAGE;
     uint8_t i, j;
     for (i = 0; i < 2; i++) {
-        lcd_writeHexWord(addr);
+        lcd_writeHexWord(os_blockToAddr(heap, block));
         lcd_writeProgString(PSTR(": "));
         for (j = 0; j < 16 - 6; j++) {
-            if (addr < os_getUseStart(heap) + os_getUseSize(heap)) {
-                lcd_writeHexNibble(derefMap(heap, addr++));
+            if (block < heap->blockCount) {
+                lcd_writeHexNibble(derefMap(heap, block++));
             } else {
                 i = j = 16;
             }
@@ -1115,8 +1246,8 @@ make_pagehandler(tm_heap_contents, tm_null, 0, 0, OS_PR_SHOW_HEAP, null, 0) {
  */
 make_pagehandler(tm_heap_chunks, tm_null, 0, 0, OS_PR_SHOW_HEAP, null, 0) {
     Heap* const heap = os_lookupHeap(peekStack(2).param);
-    uint16_t const addr = os_getUseStart(heap) + peekStack(0).param;
-    MemValue const owner = derefMap(heap, addr);
+    MemAddr const addr = os_blockToAddr(heap, peekStack(0).param);
+    MemValue const owner = derefMap(heap, peekStack(0).param);
     if (owner == 0 || owner == 0xF) {
         return false;
     }
@@ -1136,6 +1267,113 @@ make_pagehandler(tm_heap_chunks, tm_null, 0, 0, OS_PR_SHOW_HEAP, null, 0) {
     return true;
 }
 
+#if OS_MEM_STATS
+
+// Forward declarations
+static tm_page tm_heap_stats_reset;
+
+/*!
+ *  Writes allocation counters in two lines behind what is already on the
+ *  display: calls, failures, frees and bytes held.
+ */
+static void writeAllocStats(AllocStats const* stats) {
+    lcd_writeProgString(PSTR(" A:"));
+    lcd_writeDec(stats->allocs);
+    lcd_writeProgString(PSTR(" X:"));
+    lcd_writeDec(stats->failures);
+    lcd_line2();
+    lcd_writeProgString(PSTR("F:"));
+    lcd_writeDec(stats->frees);
+    lcd_writeProgString(PSTR(" L:"));
+    lcd_writeDec(stats->liveBytes);
+}
+
+#endif
+
+/*!
+ *  The pages to show the allocation statistics of the previously selected
+ *  heap. The first one shows the free bytes, the number of free runs, the
+ *  largest run and the external fragmentation. With OS_MEM_STATS it is
+ *  followed by the totals (A: allocations, X: failed ones, F: frees, L: bytes
+ *  held), the bytes requested and the average time in the allocation strategy,
+ *  the counters of every process slot that has used the heap and resetting.
+ */
+make_pagehandler(tm_heap_stats, tm_null, 0, 0, OS_PR_SHOW_HEAP, null, 0) {
+    Heap* const heap = os_lookupHeap(peekStack(2).param);
+    uint16_t const page = peekStack(0).param;
+    if (page == 0) {
+        HeapFragmentation frag;
+        os_memStats_fragmentation(heap, &frag);
+        lcd_writeProgString(PSTR("Free:"));
+        lcd_writeDec(frag.freeBytes);
+        lcd_writeProgString(PSTR(" R:"));
+        lcd_writeDec(frag.runs);
+        lcd_line2();
+        lcd_writeProgString(PSTR("Max:"));
+        lcd_writeDec(frag.largestRun);
+        lcd_writeProgString(PSTR(" Ex:"));
+        lcd_writeDec(os_memStats_externalFragmentation(&frag));
+        lcd_writeChar('%');
+        return true;
+    }
+#if OS_MEM_STATS
+    AllocStats total;
+    os_memStats_total(heap, &total);
+    if (page == 1) {
+        lcd_writeProgString(PSTR("All"));
+        writeAllocStats(&total);
+        return true;
+    }
+    if (page == 2) {
+        lcd_writeProgString(PSTR("Req:"));
+        if (heap->bytesRequested > UINT16_MAX) {
+            lcd_writeDec(heap->bytesRequested >> 10);
+            lcd_writeProgString(PSTR("kB"));
+        } else {
+            lcd_writeDec(heap->bytesRequested);
+            lcd_writeChar('B');
+        }
+        lcd_line2();
+        lcd_writeProgString(PSTR("Strat.:"));
+        lcd_writeDec(total.allocs ? ((heap->strategyTime / total.allocs) * TC0_PRESCALER) / (F_CPU / 1000000ul) : 0);
+        lcd_writeProgString(PSTR("us/call"));
+        return true;
+    }
+    if (page == TM_HEAP_STATS_PAGES - 1) {
+        lcd_writeProgString(PSTR("Reset statistics"));
+        result->call = tm_heap_stats_reset;
+        result->param = 0;
+        result->range = 1;
+        return true;
+    }
+    ProcessID const pid = page - TM_HEAP_STATS_PROCS;
+    AllocStats const* stats = os_memStats_process(heap, pid);
+    if (stats->allocs == 0 && stats->frees == 0 && stats->liveBytes == 0) {
+        return false;
+    }
+    lcd_writeChar('#');
+    lcd_writeDec(pid);
+    writeAllocStats(stats);
+    return true;
+#else
+    return false;
+#endif
+}
+
+#if OS_MEM_STATS
+
+/*!
+ *  The page to clear the allocation counters of the previously selected heap.
+ */
+make_pagehandler(tm_heap_stats_reset, tm_null, 0, 0, OS_PR_SHOW_HEAP, null, 0) {
+    lcd_writeProgString(PSTR("Resetting..."));
+    os_memStats_reset(os_lookupHeap(peekStack(3).param));
+    tm_done();
+    return true;
+}
+
+#endif
+
 make_pagehandler(tm_heap_erase, tm_heap_erase2, 0, 1, OS_PR_ERASE_HEAP, heapId, peekStack(2).param) {
     lcd_writeProgString(PSTR("Erase map+dat of"));
     lcd_writeString(getHeapName(peekStack(2).param));
@@ -1149,21 +1387,34 @@ make_pagehandler(tm_heap_erase2, tm_null, 0, 0, OS_PR_ERASE_HEAP, heapId, peekSt
     lcd_writeProgString(PSTR("..."));
     Heap* const heap = os_lookupHeap(peekStack(3).param);
     MemAddr start = os_getMapStart(heap);
-    MemAddr end = os_getMapStart(heap) + os_getMapSize(heap);
-    MemAddr const mapEnd = end;
-    MemAddr ptr;
+    uint16_t size = os_getMapSize(heap);
+    bool inMap = true;
     uint8_t lastProgress = 0;
-    for (ptr = start; ptr < end; ptr++) {
-        heap->driver->write(ptr, 0);
-        uint8_t progress = (100ul * (uint16_t)(ptr - start)) / (uint16_t)(end - start);
+    // Count the erased bytes instead of moving an address, the use area may end at the top of the address space
+    for (uint16_t done = 0; done < size; ) {
+        // Erase a block at once, but do not cross from map to use area
+        uint16_t const block = ((size - done) < TM_ERASE_BLOCK) ? (size - done) : TM_ERASE_BLOCK;
+        heap->driver->fill(start + done, 0, block);
+        done += block;
+        uint8_t progress = (100ul * done) / size;
         if (((uint16_t)progress * 32ul) / 100ul != ((uint16_t)lastProgress * 32ul) / 100ul) {
             lcd_drawBar((lastProgress = progress));
         }
-        if (ptr + 1 == mapEnd) {
-            ptr = (start = os_getUseStart(heap)) - 1;
-            end = os_getUseStart(heap) + os_getUseSize(heap);
+        // The use area follows the map, unless os_malloc zeroes chunks lazily
+        if (!OS_MEM_LAZY_ZERO && inMap && done == size) {
+            inMap = false;
+            start = os_getUseStart(heap);
+            size = os_getUseSize(heap);
+            done = 0;
         }
     }
+    os_memIndex_reset(heap);
+    os_memOwners_reset(heap);
+    os_memBuddy_reset(heap);
+    os_memHandles_reset(heap);
+    for (ProcessID pid = 0; pid < MAX_NUMBER_OF_PROCESSES; pid++) {
+        os_memStats_releaseAll(heap, pid);
+    }
     tm_done();
     return true;
 }
@@ -17,6 +17,9 @@
     #warning "Please fix the VERSUCH-define"
 #endif
 
+// The benchmark image runs its own programs (see os_bench.c)
+#if !SPOS_BENCH
+
 //---- Adjust here what to test -------------------
 #define FIRST  1
 #define NEXT   0 // Optional in Versuch 3
@@ -283,3 +286,5 @@ void program1(void) {
 	lcd_writeProgString(PSTR(" WAIT FOR IDLE  "));
     delayMs(DEFAULT_OUTPUT_DELAY * 6);
 }
+
+#endif
@@ -47,6 +47,20 @@ Time os_systemTime_coarse(void) {
     return os_systemTime_overflows * 1000 / (F_CPU/TC0_PRESCALER/256);
 } 
 
+/*!
+ * Function that returns the raw number of Timer 0 overflows, which is cheaper to compare
+ * than the system time in ms (one overflow every 256*TC0_PRESCALER cycles, ~3.3 ms)
+ *
+ * \return os_systemTime_overflows read atomically
+ */
+Time os_systemTime_overflowCount(void) {
+    uint8_t sreg = SREG;
+    cli();
+    Time overflows = os_systemTime_overflows;
+    SREG = sreg;
+    return overflows;
+}
+
 /*!
  * Function augments os_systemTime_overflows to increase precision to approx 13 us (presc/f_cpu = 256/20MHz)
  *
@@ -71,6 +85,20 @@ static Time os_systemTime_augment(void) {
     return ((os_systemTime_overflows<<8) | TCNT0);
 }
 
+/*!
+ * Function that returns the system time in Timer 0 counts (TC0_PRESCALER cycles, ~13 us each)
+ * without converting it to ms, for measuring short intervals cheaply
+ *
+ * \return os_systemTime_overflows augmented by TCNT0
+ */
+Time os_systemTime_ticks(void) {
+    uint8_t sreg = SREG;
+    cli();
+    Time ticks = os_systemTime_augment();
+    SREG = sreg;
+    return ticks;
+}
+
 /*!
  * Function that returns the current systemtime in ms augmented by additional timer registers,
  * leading to higher accuracy at expense of performance. If not needed better use os_systemTime_coarse()
@@ -14,12 +14,15 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-#include <avr/pgmspace.h>
+#include "os_hal.h"
 
 typedef uint32_t Time;
 
 #define TC0_PRESCALER 256
 
+//! Number of Timer 0 overflows per second, the resolution of os_systemTime_coarse
+#define TC0_OVERFLOWS_PER_S (F_CPU/TC0_PRESCALER/256)
+
 //----------------------------------------------------------------------------
 // Function headers
 //----------------------------------------------------------------------------
@@ -33,6 +36,12 @@ Time os_systemTime_coarse(void);
 //! Precise system time in ms
 Time os_systemTime_precise(void);
 
+//! Coarse system time in Timer 0 overflows
+Time os_systemTime_overflowCount(void);
+
+//! Precise system time in Timer 0 counts
+Time os_systemTime_ticks(void);
+
 //! Waits for some milliseconds
 void delayMs(Time ms);
 
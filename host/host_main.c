@@ -0,0 +1,598 @@
+/*! \file
+ *  \brief Randomized stress run of the allocator and the scheduling
+ *  strategies on the host (`make host`).
+ *
+ *  Every allocation is mirrored in a table of slots and filled with a pattern
+ *  derived from its slot. After each operation the chunk must be owned by the
+ *  right process in the map, and its pattern must survive until it is freed,
+ *  so overlapping chunks and lost realloc contents are caught right away.
+ *  The run ends with the garbage collection, which must leave the map empty.
+ *
+ *  Usage: spos_host [seed] [operations per heap and strategy]
+ *
+ *  Results are printed as lines
+ *
+ *      HOST <op> <heap> <variant> <count> <failed> <ops/s>
+ */
+
+#include "os_hal_host.h"
+#include "os_memory.h"
+#include "os_memory_arena.h"
+#include "os_memory_handles.h"
+#include "os_memory_pool.h"
+#include "os_memory_stats.h"
+#include "os_scheduling_strategies.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//! Number of chunks that are live at most
+#define HOST_SLOTS 64
+
+//! Largest chunk requested by os_malloc and os_realloc (in bytes)
+#define HOST_MAX_CHUNK 48
+
+//! Default number of operations per heap and strategy
+#define HOST_OPERATIONS 20000
+
+//! Slot size and number of slots of the pool, fewer slots than HOST_SLOTS so the pool runs dry
+#define HOST_POOL_OBJECT 6
+#define HOST_POOL_COUNT 32
+
+//! Size of the chunks of the arena, smaller than HOST_SLOTS allocations so the arena grows
+#define HOST_ARENA_CHUNK 96
+
+//! Names of the allocation strategies as printed in the results
+static char const *const strategyNames[] = {"first", "next", "best", "worst", "buddy"};
+
+//! Names of the scheduling strategies as printed in the results
+static char const *const schedulerNames[] = {"even", "random", "rtc", "rr", "aging"};
+
+//! A chunk allocated by the stress run
+typedef struct {
+	MemAddr addr;
+	uint16_t size;
+	ProcessID owner;
+} Slot;
+
+static Slot slots[HOST_SLOTS];
+
+//! Number of mismatches found, the run fails if it is not 0
+static unsigned long errors;
+
+static double seconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void report(char const *op, char const *heap, char const *variant, unsigned long count, unsigned long failed, double elapsed) {
+	printf("HOST %s %s %s %lu %lu %.0f\n", op, heap, variant, count, failed, elapsed > 0 ? count / elapsed : 0.0);
+}
+
+static void fail(char const *what, Heap const *heap, unsigned slot) {
+	fprintf(stderr, "%s: %s in slot %u (addr 0x%04x, size %u, owner %u)\n", heap->name, what, slot, slots[slot].addr, slots[slot].size, slots[slot].owner);
+	errors++;
+}
+
+static MemValue pattern(unsigned slot, uint16_t offset) {
+	return (MemValue)(slot * 37 + offset);
+}
+
+static void fillSlot(Heap const *heap, unsigned slot) {
+	MemValue *memory = host_memory(heap->driver);
+	for (uint16_t i = 0; i < slots[slot].size; i++) {
+		memory[slots[slot].addr + i] = pattern(slot, i);
+	}
+}
+
+//! Compares the first length bytes of the chunk with the pattern of slot
+static void checkPattern(Heap const *heap, unsigned slot, MemAddr addr, uint16_t length) {
+	MemValue const *memory = host_memory(heap->driver);
+	for (uint16_t i = 0; i < length; i++) {
+		if (memory[addr + i] != pattern(slot, i)) {
+			fail("contents lost", heap, slot);
+			return;
+		}
+	}
+}
+
+//! Checks that length bytes from addr on are 0, as lazy zeroing promises
+static void checkZero(Heap const *heap, unsigned slot, MemAddr addr, uint16_t length) {
+	MemValue const *memory = host_memory(heap->driver);
+	for (uint16_t i = 0; i < length; i++) {
+		if (memory[addr + i] != 0) {
+			fail("not zeroed", heap, slot);
+			return;
+		}
+	}
+}
+
+//! Bytes a chunk of size bytes takes, whole blocks of the heap
+static uint16_t capacity(Heap const *heap, uint16_t size) {
+	return os_chunkBlocks(heap, size) << heap->blockShift;
+}
+
+//! Checks that the map shows the chunk of slot with its owner and size
+static void checkChunk(Heap const *heap, unsigned slot) {
+	uint16_t const nib = os_addrToBlock(heap, slots[slot].addr);
+	if (getNibble(heap, nib) != slots[slot].owner) {
+		fail("wrong owner", heap, slot);
+	} else if (os_getChunkSize(heap, slots[slot].addr) != capacity(heap, slots[slot].size)) {
+		fail("wrong size", heap, slot);
+	}
+}
+
+/*!
+ *  Runs random os_malloc, os_realloc and os_free calls of random processes
+ *  on the heap with one strategy, then collects everything with
+ *  os_freeProcessMemory.
+ */
+static void stressHeap(Heap *heap, AllocStrategy strategy, unsigned long operations) {
+	unsigned long count[3] = {0};
+	unsigned long failed[3] = {0};
+	double elapsed[3] = {0};
+
+	os_setAllocationStrategy(heap, strategy);
+	memset(slots, 0, sizeof(slots));
+
+	for (unsigned long n = 0; n < operations; n++) {
+		unsigned const slot = rand() % HOST_SLOTS;
+		Slot *s = &slots[slot];
+
+		if (!s->addr) {
+			uint16_t const size = 1 + rand() % HOST_MAX_CHUNK;
+			ProcessID const pid = 1 + rand() % (MAX_NUMBER_OF_PROCESSES - 1);
+			host_setCurrentProc(pid);
+			double const start = seconds();
+			MemAddr const addr = os_malloc(heap, size);
+			elapsed[0] += seconds() - start;
+			count[0]++;
+			if (!addr) {
+				failed[0]++;
+				continue;
+			}
+			s->addr = addr;
+			s->size = size;
+			s->owner = pid;
+			checkChunk(heap, slot);
+			if (OS_MEM_LAZY_ZERO) {
+				checkZero(heap, slot, addr, capacity(heap, size));
+			}
+			fillSlot(heap, slot);
+		} else if (rand() % 2) {
+			uint16_t const size = 1 + rand() % HOST_MAX_CHUNK;
+			host_setCurrentProc(s->owner);
+			double const start = seconds();
+			MemAddr const addr = os_realloc(heap, s->addr, size);
+			elapsed[1] += seconds() - start;
+			count[1]++;
+			if (!addr) {
+				failed[1]++;
+				checkPattern(heap, slot, s->addr, s->size);
+				continue;
+			}
+			checkPattern(heap, slot, addr, (size < s->size) ? size : s->size);
+			// Only blocks the chunk did not have before are zeroed
+			if (OS_MEM_LAZY_ZERO && capacity(heap, size) > capacity(heap, s->size)) {
+				checkZero(heap, slot, addr + capacity(heap, s->size), capacity(heap, size) - capacity(heap, s->size));
+			}
+			s->addr = addr;
+			s->size = size;
+			checkChunk(heap, slot);
+			fillSlot(heap, slot);
+		} else {
+			checkPattern(heap, slot, s->addr, s->size);
+			host_setCurrentProc(s->owner);
+			double const start = seconds();
+			os_free(heap, s->addr);
+			elapsed[2] += seconds() - start;
+			count[2]++;
+			if (getNibble(heap, os_addrToBlock(heap, s->addr)) != 0) {
+				fail("not freed", heap, slot);
+			}
+			s->addr = 0;
+		}
+
+		if (criticalSectionCount != 0) {
+			fprintf(stderr, "%s: critical section left open\n", heap->name);
+			errors++;
+			criticalSectionCount = 0;
+		}
+	}
+
+	for (unsigned slot = 0; slot < HOST_SLOTS; slot++) {
+		if (slots[slot].addr) {
+			checkChunk(heap, slot);
+			checkPattern(heap, slot, slots[slot].addr, slots[slot].size);
+		}
+	}
+
+	host_setCurrentProc(0);
+	for (ProcessID pid = 1; pid < MAX_NUMBER_OF_PROCESSES; pid++) {
+		os_freeProcessMemory(heap, pid);
+	}
+	if (os_mapSkipEqual(heap, 0, heap->blockCount, 0) != heap->blockCount) {
+		fprintf(stderr, "%s: garbage collection left chunks behind\n", heap->name);
+		errors++;
+	}
+#if OS_MEM_STATS
+	AllocStats total;
+	os_memStats_total(heap, &total);
+	if (total.liveBytes != 0) {
+		fprintf(stderr, "%s: %lu live bytes after garbage collection\n", heap->name, (unsigned long)total.liveBytes);
+		errors++;
+	}
+#endif
+
+	report("os_malloc", heap->name, strategyNames[strategy], count[0], failed[0], elapsed[0]);
+	report("os_realloc", heap->name, strategyNames[strategy], count[1], failed[1], elapsed[1]);
+	report("os_free", heap->name, strategyNames[strategy], count[2], failed[2], elapsed[2]);
+}
+
+/*!
+ *  Runs random os_poolAlloc and os_poolFree calls on a pool in the heap. The
+ *  pool may only run dry once all of its slots are in use, and every slot
+ *  must lie inside the pool and keep its pattern. The garbage collection
+ *  releases the pool at the end.
+ */
+static void stressPool(Heap *heap, unsigned long operations) {
+	unsigned long count[2] = {0};
+	unsigned long failed[2] = {0};
+	double elapsed[2] = {0};
+	unsigned held = 0;
+
+	os_setAllocationStrategy(heap, OS_MEM_FIRST);
+	memset(slots, 0, sizeof(slots));
+	host_setCurrentProc(1);
+	MemAddr const pool = os_poolCreate(heap, HOST_POOL_OBJECT, HOST_POOL_COUNT);
+	if (!pool) {
+		fprintf(stderr, "%s: no space for the pool\n", heap->name);
+		errors++;
+		return;
+	}
+	MemAddr const poolEnd = pool + os_getChunkSize(heap, pool);
+
+	for (unsigned long n = 0; n < operations; n++) {
+		unsigned const slot = rand() % HOST_SLOTS;
+		Slot *s = &slots[slot];
+
+		if (!s->addr) {
+			double const start = seconds();
+			MemAddr const addr = os_poolAlloc(heap, pool);
+			elapsed[0] += seconds() - start;
+			count[0]++;
+			if (!addr) {
+				failed[0]++;
+				if (held < HOST_POOL_COUNT) {
+					fail("pool ran dry early", heap, slot);
+				}
+				continue;
+			}
+			s->addr = addr;
+			s->size = HOST_POOL_OBJECT;
+			s->owner = 1;
+			held++;
+			if (addr < pool || addr + HOST_POOL_OBJECT > poolEnd) {
+				fail("slot outside of the pool", heap, slot);
+			}
+			fillSlot(heap, slot);
+		} else {
+			checkPattern(heap, slot, s->addr, s->size);
+			double const start = seconds();
+			os_poolFree(heap, pool, s->addr);
+			elapsed[1] += seconds() - start;
+			count[1]++;
+			s->addr = 0;
+			held--;
+		}
+	}
+
+	for (unsigned slot = 0; slot < HOST_SLOTS; slot++) {
+		if (slots[slot].addr) {
+			checkPattern(heap, slot, slots[slot].addr, slots[slot].size);
+		}
+	}
+	os_freeProcessMemory(heap, 1);
+	if (os_mapSkipEqual(heap, 0, heap->blockCount, 0) != heap->blockCount) {
+		fprintf(stderr, "%s: garbage collection left the pool behind\n", heap->name);
+		errors++;
+	}
+
+	report("os_poolAlloc", heap->name, "pool", count[0], failed[0], elapsed[0]);
+	report("os_poolFree", heap->name, "pool", count[1], failed[1], elapsed[1]);
+}
+
+/*!
+ *  Fills an arena in the heap with random os_arenaAlloc calls and resets it
+ *  now and then (at the latest when all slots are used). Until a reset the
+ *  allocations must keep their patterns, which catches overlaps. The garbage
+ *  collection releases the arena with all its chunks at the end.
+ */
+static void stressArena(Heap *heap, unsigned long operations) {
+	unsigned long count[2] = {0};
+	unsigned long failed[2] = {0};
+	double elapsed[2] = {0};
+	unsigned used = 0;
+
+	os_setAllocationStrategy(heap, OS_MEM_FIRST);
+	memset(slots, 0, sizeof(slots));
+	host_setCurrentProc(1);
+	MemAddr const arena = os_arenaCreate(heap, HOST_ARENA_CHUNK);
+	if (!arena) {
+		fprintf(stderr, "%s: no space for the arena\n", heap->name);
+		errors++;
+		return;
+	}
+
+	for (unsigned long n = 0; n < operations; n++) {
+		if (used == HOST_SLOTS || rand() % 32 == 0) {
+			for (unsigned slot = 0; slot < used; slot++) {
+				if (slots[slot].addr) {
+					checkPattern(heap, slot, slots[slot].addr, slots[slot].size);
+				}
+			}
+			double const start = seconds();
+			os_arenaReset(heap, arena);
+			elapsed[1] += seconds() - start;
+			count[1]++;
+			memset(slots, 0, sizeof(slots));
+			used = 0;
+			continue;
+		}
+
+		unsigned const slot = used++;
+		uint16_t const size = 1 + rand() % HOST_MAX_CHUNK;
+		double const start = seconds();
+		MemAddr const addr = os_arenaAlloc(heap, arena, size);
+		elapsed[0] += seconds() - start;
+		count[0]++;
+		if (!addr) {
+			failed[0]++;
+			continue;
+		}
+		slots[slot].addr = addr;
+		slots[slot].size = size;
+		slots[slot].owner = 1;
+		if (getNibble(heap, os_addrToBlock(heap, addr)) == 0) {
+			fail("outside of the arena", heap, slot);
+		}
+		if (OS_MEM_LAZY_ZERO) {
+			checkZero(heap, slot, addr, size);
+		}
+		fillSlot(heap, slot);
+	}
+
+	os_freeProcessMemory(heap, 1);
+	if (os_mapSkipEqual(heap, 0, heap->blockCount, 0) != heap->blockCount) {
+		fprintf(stderr, "%s: garbage collection left the arena behind\n", heap->name);
+		errors++;
+	}
+
+	report("os_arenaAlloc", heap->name, "arena", count[0], failed[0], elapsed[0]);
+	report("os_arenaReset", heap->name, "arena", count[1], failed[1], elapsed[1]);
+}
+
+#if OS_MEM_HANDLES
+/*!
+ *  Runs random os_hmalloc, os_hrealloc, os_hfree, os_hlock and os_hunlock
+ *  calls together with compaction steps on the heap. Locked chunks must stay
+ *  where they are, and moved chunks must keep their patterns. Once everything
+ *  is unlocked, the compaction must leave a single free run. Finally the
+ *  process is killed while the compaction is moving one of its chunks.
+ */
+static void stressHandles(Heap *heap, unsigned long operations) {
+	MemHandle handles[OS_MEM_HANDLES] = {0};
+	unsigned long count[2] = {0};
+	unsigned long failed[2] = {0};
+	double elapsed[2] = {0};
+
+	os_setAllocationStrategy(heap, OS_MEM_FIRST);
+	memset(slots, 0, sizeof(slots));
+	host_setCurrentProc(1);
+
+	for (unsigned long n = 0; n < operations; n++) {
+		unsigned const slot = rand() % OS_MEM_HANDLES;
+		Slot *s = &slots[slot];
+
+		if (!handles[slot]) {
+			uint16_t const size = 1 + rand() % HOST_MAX_CHUNK;
+			double const start = seconds();
+			handles[slot] = os_hmalloc(heap, size);
+			elapsed[0] += seconds() - start;
+			count[0]++;
+			if (!handles[slot]) {
+				failed[0]++;
+				continue;
+			}
+			s->addr = os_hlock(heap, handles[slot]);
+			s->size = size;
+			s->owner = 1;
+			fillSlot(heap, slot);
+		} else if (rand() % 4 == 0) {
+			if (!s->addr) {
+				s->addr = os_hlock(heap, handles[slot]);
+			}
+			checkPattern(heap, slot, s->addr, s->size);
+			os_hfree(heap, handles[slot]);
+			handles[slot] = 0;
+			s->addr = 0;
+			continue;
+		} else if (!s->addr && rand() % 4 == 0) {
+			uint16_t const size = 1 + rand() % HOST_MAX_CHUNK;
+			if (os_hrealloc(heap, handles[slot], size)) {
+				s->addr = os_hlock(heap, handles[slot]);
+				checkPattern(heap, slot, s->addr, (size < s->size) ? size : s->size);
+				s->size = size;
+				fillSlot(heap, slot);
+			}
+		} else if (s->addr) {
+			os_hunlock(heap, handles[slot]);
+			s->addr = 0;
+		} else {
+			s->addr = os_hlock(heap, handles[slot]);
+			checkPattern(heap, slot, s->addr, s->size);
+		}
+
+		double const start = seconds();
+		os_memCompact(heap);
+		elapsed[1] += seconds() - start;
+		count[1]++;
+		for (unsigned other = 0; other < OS_MEM_HANDLES; other++) {
+			if (slots[other].addr && os_hlock(heap, handles[other]) != slots[other].addr) {
+				fail("locked chunk moved", heap, other);
+			}
+			if (slots[other].addr) {
+				os_hunlock(heap, handles[other]);
+			}
+		}
+	}
+
+	for (unsigned slot = 0; slot < OS_MEM_HANDLES; slot++) {
+		if (slots[slot].addr) {
+			os_hunlock(heap, handles[slot]);
+			slots[slot].addr = 0;
+		}
+	}
+	for (unsigned long steps = 0; os_memCompact(heap); steps++) {
+		if (steps > heap->blockCount) {
+			fprintf(stderr, "%s: compaction does not end\n", heap->name);
+			errors++;
+			break;
+		}
+	}
+	HeapFragmentation frag;
+	os_memStats_fragmentation(heap, &frag);
+	if (frag.runs > 1) {
+		fprintf(stderr, "%s: %u free runs left after the compaction\n", heap->name, frag.runs);
+		errors++;
+	}
+	for (unsigned slot = 0; slot < OS_MEM_HANDLES; slot++) {
+		if (handles[slot]) {
+			MemAddr const addr = os_hlock(heap, handles[slot]);
+			checkPattern(heap, slot, addr, slots[slot].size);
+			os_hunlock(heap, handles[slot]);
+		}
+	}
+
+	// Free every other chunk, so the compaction has something to move when the process is killed
+	for (unsigned slot = 0; slot < OS_MEM_HANDLES; slot += 2) {
+		if (handles[slot]) {
+			os_hfree(heap, handles[slot]);
+			handles[slot] = 0;
+		}
+	}
+	while (heap->compactHandle == 0 && os_memCompact(heap));
+
+	os_freeProcessMemory(heap, 1);
+	if (os_mapSkipEqual(heap, 0, heap->blockCount, 0) != heap->blockCount || heap->compactHandle != 0) {
+		fprintf(stderr, "%s: garbage collection left handles behind\n", heap->name);
+		errors++;
+	}
+	for (unsigned slot = 0; slot < OS_MEM_HANDLES; slot++) {
+		if (handles[slot] && os_hlock(heap, handles[slot])) {
+			fprintf(stderr, "%s: garbage collection left handle %u behind\n", heap->name, slot);
+			errors++;
+		}
+	}
+
+	report("os_hmalloc", heap->name, "handle", count[0], failed[0], elapsed[0]);
+	report("os_memCompact", heap->name, "handle", count[1], failed[1], elapsed[1]);
+}
+#endif
+
+/*!
+ *  Calls every scheduling strategy with random ready masks. The choice must
+ *  be a ready process. The idle process may only be chosen if no other one is
+ *  ready or if it keeps running (the rest of a round-robin time slice).
+ */
+static void stressScheduler(unsigned long operations) {
+	static ProcessID (*const strategies[])(Process const[], ProcessID) = {
+		os_Scheduler_Even,
+		os_Scheduler_Random,
+		os_Scheduler_RunToCompletion,
+		os_Scheduler_RoundRobin,
+		os_Scheduler_InactiveAging
+	};
+
+	for (uint8_t strategy = 0; strategy < sizeof(strategies) / sizeof(*strategies); strategy++) {
+		unsigned long wrong = 0;
+		ProcessID current = 0;
+
+		for (ProcessID pid = 0; pid < MAX_NUMBER_OF_PROCESSES; pid++) {
+			host_setUnused(pid);
+		}
+		host_setReady(0, DEFAULT_PRIORITY);
+		host_setCurrentProc(0);
+		os_resetSchedulingInformation((SchedulingStrategy)strategy);
+		for (ProcessID pid = 0; pid < MAX_NUMBER_OF_PROCESSES; pid++) {
+			os_resetProcessSchedulingInformation(pid);
+		}
+
+		double const start = seconds();
+		for (unsigned long n = 0; n < operations; n++) {
+			// Start or end one process now and then, like os_exec and os_kill
+			if (rand() % 8 == 0) {
+				ProcessID const pid = 1 + rand() % (MAX_NUMBER_OF_PROCESSES - 1);
+				if (os_processes[pid].state == OS_PS_UNUSED) {
+					host_setReady(pid, 1 + rand() % 255);
+					os_resetProcessSchedulingInformation(pid);
+				} else {
+					host_setUnused(pid);
+				}
+			}
+			if (os_processes[current].state == OS_PS_RUNNING) {
+				os_processes[current].state = OS_PS_READY;
+			}
+
+			ProcessID const next = strategies[strategy](os_processes, current);
+
+			bool const othersReady = (os_readyMask & ~1) != 0;
+			bool const idleAllowed = !othersReady || current == 0;
+			if (next >= MAX_NUMBER_OF_PROCESSES || os_processes[next].state != OS_PS_READY || (next == 0 && !idleAllowed) || (next != 0 && !othersReady)) {
+				wrong++;
+			}
+			current = next;
+			os_processes[current].state = OS_PS_RUNNING;
+			host_setCurrentProc(current);
+		}
+		double const elapsed = seconds() - start;
+
+		if (wrong) {
+			fprintf(stderr, "scheduler %s: %lu invalid choices\n", schedulerNames[strategy], wrong);
+			errors += wrong;
+		}
+		report("schedule", "-", schedulerNames[strategy], operations, wrong, elapsed);
+	}
+}
+
+int main(int argc, char **argv) {
+	unsigned const seed = (argc > 1) ? (unsigned)strtoul(argv[1], NULL, 0) : 1;
+	unsigned long const operations = (argc > 2) ? strtoul(argv[2], NULL, 0) : HOST_OPERATIONS;
+	srand(seed);
+
+	initMemoryDriver();
+	os_initHeaps();
+
+	printf("HOST op heap variant count failed ops/s (seed %u)\n", seed);
+	for (uint8_t i = 0; i < os_getHeapListLength(); i++) {
+		for (uint8_t strategy = 0; strategy < sizeof(strategyNames) / sizeof(*strategyNames); strategy++) {
+			stressHeap(os_lookupHeap(i), (AllocStrategy)strategy, operations);
+		}
+		stressPool(os_lookupHeap(i), operations);
+		stressArena(os_lookupHeap(i), operations);
+#if OS_MEM_HANDLES
+		stressHandles(os_lookupHeap(i), operations);
+#endif
+	}
+	stressScheduler(operations);
+
+	if (errors) {
+		printf("HOST failed %lu\n", errors);
+		return EXIT_FAILURE;
+	}
+	printf("HOST done\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,173 @@
+/*! \file
+ *  \brief In-RAM memory drivers and scheduler stand-ins for host builds.
+ */
+
+#include "os_hal_host.h"
+#include "os_core.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//----------------------------------------------------------------------------
+// Memory drivers
+//----------------------------------------------------------------------------
+
+MemDriver intSRAM__;
+
+MemDriver extSRAM__;
+
+//! Contents of the internal SRAM, the register file below AVR_SRAM_START is left unused
+static MemValue internalMemory[AVR_SRAM_END];
+
+//! Contents of the external 23LC1024 (the part the driver addresses)
+static MemValue externalMemory[0x10000];
+
+MemValue* host_memory(MemDriver const *driver) {
+	return (driver == intSRAM) ? internalMemory : externalMemory;
+}
+
+//! Aborts on accesses a real driver would silently wrap or corrupt with
+static MemValue* locate(MemDriver const *driver, MemAddr addr, uint16_t length) {
+	if (addr < driver->firstAddr || (uint32_t)addr + length > (uint32_t)driver->firstAddr + driver->size) {
+		fprintf(stderr, "%s access out of range: 0x%04x+%u\n", (driver == intSRAM) ? "internal" : "external", addr, length);
+		abort();
+	}
+	return host_memory(driver) + addr;
+}
+
+static void host_init(void) {}
+
+static MemValue internal_read(MemAddr addr) {
+	return *locate(intSRAM, addr, 1);
+}
+
+static void internal_write(MemAddr addr, MemValue value) {
+	*locate(intSRAM, addr, 1) = value;
+}
+
+static void internal_readBlock(MemAddr addr, MemValue *buffer, uint16_t length) {
+	memcpy(buffer, locate(intSRAM, addr, length), length);
+}
+
+static void internal_writeBlock(MemAddr addr, MemValue const *buffer, uint16_t length) {
+	memmove(locate(intSRAM, addr, length), buffer, length);
+}
+
+static void internal_fill(MemAddr addr, MemValue value, uint16_t length) {
+	memset(locate(intSRAM, addr, length), value, length);
+}
+
+static MemValue external_read(MemAddr addr) {
+	return *locate(extSRAM, addr, 1);
+}
+
+static void external_write(MemAddr addr, MemValue value) {
+	*locate(extSRAM, addr, 1) = value;
+}
+
+static void external_readBlock(MemAddr addr, MemValue *buffer, uint16_t length) {
+	memcpy(buffer, locate(extSRAM, addr, length), length);
+}
+
+static void external_writeBlock(MemAddr addr, MemValue const *buffer, uint16_t length) {
+	memmove(locate(extSRAM, addr, length), buffer, length);
+}
+
+static void external_fill(MemAddr addr, MemValue value, uint16_t length) {
+	memset(locate(extSRAM, addr, length), value, length);
+}
+
+//! Same layout as the target drivers in os_mem_drivers.c
+void initMemoryDriver(void) {
+	intSRAM__.init = &host_init;
+	intSRAM__.read = &internal_read;
+	intSRAM__.write = &internal_write;
+	intSRAM__.readBlock = &internal_readBlock;
+	intSRAM__.writeBlock = &internal_writeBlock;
+	intSRAM__.fill = &internal_fill;
+	intSRAM__.size = AVR_MEMORY_SRAM;
+	intSRAM__.firstAddr = AVR_SRAM_START;
+
+	extSRAM__.init = &host_init;
+	extSRAM__.read = &external_read;
+	extSRAM__.write = &external_write;
+	extSRAM__.readBlock = &external_readBlock;
+	extSRAM__.writeBlock = &external_writeBlock;
+	extSRAM__.fill = &external_fill;
+	extSRAM__.size = 0xFFFF;
+	extSRAM__.firstAddr = 0;
+}
+
+void external_flush(void) {}
+
+void external_invalidate(void) {}
+
+//----------------------------------------------------------------------------
+// Scheduler
+//----------------------------------------------------------------------------
+
+Process os_processes[MAX_NUMBER_OF_PROCESSES];
+
+uint8_t os_readyMask;
+
+uint8_t criticalSectionCount;
+
+static ProcessID currentProc;
+
+void os_enterCriticalSection(void) {
+	if (criticalSectionCount == 255) {
+		os_error("Critical section overflow");
+	}
+	criticalSectionCount++;
+}
+
+void os_leaveCriticalSection(void) {
+	if (criticalSectionCount == 0) {
+		os_error("Critical section underflow");
+	}
+	criticalSectionCount--;
+}
+
+ProcessID os_getCurrentProc(void) {
+	return currentProc;
+}
+
+Process* os_getProcessSlot(ProcessID pid) {
+	return &os_processes[pid];
+}
+
+void host_setCurrentProc(ProcessID pid) {
+	currentProc = pid;
+}
+
+void host_setReady(ProcessID pid, Priority priority) {
+	os_processes[pid].state = OS_PS_READY;
+	os_processes[pid].priority = priority;
+	os_readyMask |= 1 << pid;
+}
+
+void host_setUnused(ProcessID pid) {
+	os_processes[pid].state = OS_PS_UNUSED;
+	os_readyMask &= ~(1 << pid);
+}
+
+//----------------------------------------------------------------------------
+// Core and time
+//----------------------------------------------------------------------------
+
+//! Errors are fatal on the host as well, but end the run with a message
+void os_errorPStr(char const *str) {
+	fprintf(stderr, "os_error: %s\n", str);
+	exit(EXIT_FAILURE);
+}
+
+//! Monotonic clock scaled to Timer 0 counts (F_CPU / TC0_PRESCALER per second)
+Time os_systemTime_ticks(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint64_t const ns = (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+	return (Time)(ns / (1000000000u / (F_CPU / TC0_PRESCALER)));
+}
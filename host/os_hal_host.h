@@ -0,0 +1,31 @@
+/*! \file
+ *  \brief Host side of the HAL (`make host`).
+ *
+ *  Stands in for os_mem_drivers.c, os_scheduler.c and util.c when the
+ *  portable modules are built natively: Both memory drivers are backed by
+ *  arrays, the scheduler state is plain data the test program sets up and
+ *  critical sections only count their nesting.
+ */
+
+#ifndef _OS_HAL_HOST_H
+#define _OS_HAL_HOST_H
+
+#include "os_mem_drivers.h"
+#include "os_scheduler.h"
+
+//! The process table the scheduling strategies are run on
+extern Process os_processes[MAX_NUMBER_OF_PROCESSES];
+
+//! Makes pid the process os_getCurrentProc returns
+void host_setCurrentProc(ProcessID pid);
+
+//! Puts pid into the process table as ready with the given priority
+void host_setReady(ProcessID pid, Priority priority);
+
+//! Removes pid from the process table
+void host_setUnused(ProcessID pid);
+
+//! Backing store of a driver, indexed by MemAddr
+MemValue* host_memory(MemDriver const *driver);
+
+#endif